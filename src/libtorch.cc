@@ -25,7 +25,24 @@
 // OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <stdint.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <chrono>
 #include <exception>
+#include <future>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include "libtorch_buffer_arena.h"
+#include "libtorch_copy.h"
+#include "libtorch_pipeline_queue.h"
+#include "libtorch_thread_pool.h"
 #include "libtorch_utils.h"
 #include "triton/backend/backend_common.h"
 #include "triton/backend/backend_input_collector.h"
@@ -39,6 +56,7 @@
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wsign-compare"
 #pragma warning(push, 0)
+#include <torch/version.h>
 #include <torchvision/ops/ops.h>
 #include <torchvision/vision.h>  // Torchvision header
 #pragma warning(pop)
@@ -55,6 +73,170 @@
 
 namespace triton { namespace backend { namespace pytorch {
 
+//
+// BackendState
+//
+// State associated with the backend and shared by all models that
+// use it. An object of this class is created in
+// TRITONBACKEND_Initialize and associated with the
+// TRITONBACKEND_Backend.
+//
+class BackendState {
+ public:
+  BackendState(
+      const size_t model_load_thread_count, const size_t copy_thread_count,
+      const std::string& model_cache_directory,
+      const std::vector<int>& core_budget,
+      const std::vector<NumaNode>& numa_nodes)
+      : model_load_thread_count_(model_load_thread_count),
+        copy_thread_count_(copy_thread_count),
+        model_cache_directory_(model_cache_directory),
+        core_budget_(core_budget), core_reserved_(core_budget.size(), false),
+        numa_nodes_(numa_nodes), skipped_outputs_family_(nullptr)
+  {
+    // Metrics may be disabled, in which case instances don't count.
+    TRITONSERVER_Error* err = TRITONSERVER_MetricFamilyNew(
+        &skipped_outputs_family_, TRITONSERVER_METRIC_KIND_COUNTER,
+        "pytorch_skipped_outputs",
+        "Number of model outputs not scattered because no request of the "
+        "batch asked for them");
+    if (err != nullptr) {
+      LOG_MESSAGE(
+          TRITONSERVER_LOG_WARN,
+          (std::string("skipped output metric is not available: ") +
+           TRITONSERVER_ErrorMessage(err))
+              .c_str());
+      TRITONSERVER_ErrorDelete(err);
+      skipped_outputs_family_ = nullptr;
+    }
+  }
+  ~BackendState()
+  {
+    if (skipped_outputs_family_ != nullptr) {
+      LOG_IF_ERROR(
+          TRITONSERVER_MetricFamilyDelete(skipped_outputs_family_),
+          "failed to delete skipped output metric family");
+    }
+  }
+
+  // Return the pool of threads that deserialize models in the
+  // background. The pool is created on first use.
+  ThreadPool* LoaderPool();
+
+  // Return the pool of threads that help instances gather inputs and
+  // scatter outputs, nullptr if copies are serial. The pool is created
+  // on first use.
+  ThreadPool* CopyPool();
+
+  // Default directory for the cache of optimized modules, empty if
+  // not set.
+  const std::string& ModelCacheDirectory() const
+  {
+    return model_cache_directory_;
+  }
+
+  // If true, CPU instances that set an intra-op thread count are
+  // pinned to cores of the budget that no other instance is pinned to.
+  bool HasCoreBudget() const { return !core_budget_.empty(); }
+
+  // Reserve 'count' free cores of the budget, only taking cores that
+  // are in the sorted 'allowed' if not empty, and return them in
+  // 'cores'. Return false, reserving nothing, if fewer are free.
+  bool ReserveCores(
+      const size_t count, const std::vector<int>& allowed,
+      std::vector<int>* cores);
+  void ReleaseCores(const std::vector<int>& cores);
+
+  // The NUMA nodes of the host that have CPUs, empty if the topology
+  // is not available.
+  const std::vector<NumaNode>& NumaNodes() const { return numa_nodes_; }
+
+  // The counter family of outputs skipped by instances, nullptr if
+  // metrics are not available.
+  TRITONSERVER_MetricFamily* SkippedOutputsFamily() const
+  {
+    return skipped_outputs_family_;
+  }
+
+ private:
+  const size_t model_load_thread_count_;
+  const size_t copy_thread_count_;
+  const std::string model_cache_directory_;
+  std::once_flag loader_pool_once_;
+  std::unique_ptr<ThreadPool> loader_pool_;
+  std::once_flag copy_pool_once_;
+  std::unique_ptr<ThreadPool> copy_pool_;
+
+  std::mutex core_mu_;
+  const std::vector<int> core_budget_;
+  std::vector<bool> core_reserved_;
+
+  const std::vector<NumaNode> numa_nodes_;
+
+  TRITONSERVER_MetricFamily* skipped_outputs_family_;
+};
+
+ThreadPool*
+BackendState::LoaderPool()
+{
+  std::call_once(loader_pool_once_, [this] {
+    loader_pool_.reset(new ThreadPool(model_load_thread_count_));
+  });
+  return loader_pool_.get();
+}
+
+ThreadPool*
+BackendState::CopyPool()
+{
+  std::call_once(copy_pool_once_, [this] {
+    if (copy_thread_count_ > 0) {
+      copy_pool_.reset(new ThreadPool(copy_thread_count_));
+    }
+  });
+  return copy_pool_.get();
+}
+
+bool
+BackendState::ReserveCores(
+    const size_t count, const std::vector<int>& allowed,
+    std::vector<int>* cores)
+{
+  std::lock_guard<std::mutex> lk(core_mu_);
+  cores->clear();
+  for (size_t i = 0; (i < core_budget_.size()) && (cores->size() < count);
+       ++i) {
+    if (!core_reserved_[i] &&
+        (allowed.empty() || std::binary_search(
+                                allowed.begin(), allowed.end(),
+                                core_budget_[i]))) {
+      cores->push_back(core_budget_[i]);
+    }
+  }
+  if (cores->size() < count) {
+    cores->clear();
+    return false;
+  }
+
+  for (size_t i = 0; i < core_budget_.size(); ++i) {
+    if (std::binary_search(cores->begin(), cores->end(), core_budget_[i])) {
+      core_reserved_[i] = true;
+    }
+  }
+  return true;
+}
+
+void
+BackendState::ReleaseCores(const std::vector<int>& cores)
+{
+  std::lock_guard<std::mutex> lk(core_mu_);
+  for (size_t i = 0; i < core_budget_.size(); ++i) {
+    if (std::find(cores.begin(), cores.end(), core_budget_[i]) !=
+        cores.end()) {
+      core_reserved_[i] = false;
+    }
+  }
+}
+
 //
 // ModelState
 //
@@ -69,20 +251,296 @@ class ModelState : public BackendModel {
  public:
   static TRITONSERVER_Error* Create(
       TRITONBACKEND_Model* triton_model, ModelState** state);
-  virtual ~ModelState() = default;
+  virtual ~ModelState();
 
   // Load a TorchScript model using 'artifact_name' as the name for the
   // TorchScript file. Return in 'model_path' the full path to the
   // TorchScript file, return in 'torch_model' the Torch Module
-  // representing the model.
+  // representing the model. When weight sharing is enabled the file
+  // is deserialized only once per device and NUMA node and
+  // 'torch_model' is a clone of that module which shares its parameter
+  // storage. The weights are allocated from the memory of 'numa_node'
+  // unless it is negative.
   TRITONSERVER_Error* LoadModel(
       const std::string& artifact_name, const torch::Device device,
-      std::string* model_path,
+      const int numa_node, std::string* model_path,
       std::unique_ptr<torch::jit::script::Module>* torch_model);
 
+  // Whether instances should defer loading the model until they
+  // execute their first batch of requests.
+  bool LazyInstanceLoading() const { return lazy_instance_loading_; }
+
+  // Number of warmup forward calls run for each warmup batch size
+  // before an instance is ready, 0 to disable warmup.
+  int WarmupIterations() const { return warmup_iterations_; }
+  // Batch sizes to warm up. Empty to use 1 and the max batch size.
+  const std::vector<int64_t>& WarmupBatchSizes() const
+  {
+    return warmup_batch_sizes_;
+  }
+
+  // How requests that differ in the length of their ragged inputs are
+  // batched: concatenated along the ragged dimension, or padded to the
+  // longest request of the batch.
+  enum class RaggedBatching { CONCATENATE, PAD };
+  RaggedBatching RaggedBatchingMode() const { return ragged_batching_; }
+
+  // Name of the forward() argument that receives the offsets of the
+  // requests in ragged inputs, empty if not set.
+  const std::string& RaggedOffsetsArgument() const
+  {
+    return ragged_offsets_argument_;
+  }
+
+  // Name of the forward() argument that receives the mask of valid
+  // positions in padded inputs, empty if not set.
+  const std::string& PaddingMaskArgument() const
+  {
+    return padding_mask_argument_;
+  }
+
+  // Largest share, in percent, of a padded batch that may be padding
+  // before requests are split into batches of similar length.
+  int MaxPaddingPercent() const { return max_padding_percent_; }
+
+  // Ascending sizes that the batch dimension and the padded length of
+  // ragged inputs are rounded up to for each execution. Empty if the
+  // size is not bucketed.
+  const std::vector<int64_t>& BatchBuckets() const { return batch_buckets_; }
+  const std::vector<int64_t>& SequenceBuckets() const
+  {
+    return sequence_buckets_;
+  }
+
+  // Largest batch size of the micro-batches that a batch is split into
+  // to pipeline gathering, forward and scattering, 0 if batches are not
+  // split.
+  int MicroBatchSize() const { return micro_batch_size_; }
+
+  // Pool of workers that execute the requests of all instances of the
+  // model after TRITONBACKEND_ModelInstanceExecute has returned,
+  // nullptr if requests are executed synchronously.
+  WorkStealingPool* WorkerPool() { return worker_pool_.get(); }
+
+  // Number of threads of each CPU instance that execute its requests
+  // concurrently on its single module, 1 if the instance executes them
+  // on the thread that Triton calls it from.
+  int ExecutorThreadCount() const { return executor_thread_count_; }
+
+  // Pool of threads shared by all instances of the backend to gather
+  // inputs and scatter outputs, nullptr if copies are serial.
+  ThreadPool* CopyPool() { return backend_state_->CopyPool(); }
+
+  // Number of intra-op threads each instance runs forward() with, 0 to
+  // use the libtorch default.
+  int IntraOpThreadCount() const { return intra_op_thread_count_; }
+
+  // Intra-op thread count of each execution by batch size, as pairs of
+  // the largest batch size and its thread count ordered by batch size.
+  // Empty if not configured.
+  typedef std::vector<std::pair<int64_t, int>> ThreadsByBatch;
+  const ThreadsByBatch& IntraOpThreadsByBatch() const
+  {
+    return intra_op_threads_by_batch_;
+  }
+  // If true, instances learn their thread count for each warmup batch
+  // size instead.
+  bool LearnIntraOpThreads() const { return learn_intra_op_threads_; }
+
+  // Reserve and release cores of the backend's CPU core budget for
+  // an instance, see BackendState.
+  bool HasCoreBudget() const { return backend_state_->HasCoreBudget(); }
+  bool ReserveCores(
+      const size_t count, const std::vector<int>& allowed,
+      std::vector<int>* cores)
+  {
+    return backend_state_->ReserveCores(count, allowed, cores);
+  }
+
+  // Return the NUMA node that the next CPU instance of the model is
+  // placed on, nodes being taken in turn, or nullptr if instances are
+  // not placed on NUMA nodes.
+  const NumaNode* NextNumaNode();
+  void ReleaseCores(const std::vector<int>& cores)
+  {
+    backend_state_->ReleaseCores(cores);
+  }
+  TRITONSERVER_MetricFamily* SkippedOutputsFamily() const
+  {
+    return backend_state_->SkippedOutputsFamily();
+  }
+
+  // The top-K classes that a TYPE_STRING output returns in place of
+  // the scores of the model output, and the labels of the classes, if
+  // the output has a 'label_filename'.
+  struct Classification {
+    int64_t k;
+    std::vector<std::string> labels;
+  };
+  // Return the classification of output 'name', nullptr if the output
+  // returns the model output as-is.
+  const Classification* OutputClassification(const std::string& name) const
+  {
+    const auto it = classifications_.find(name);
+    return (it == classifications_.end()) ? nullptr : &it->second;
+  }
+
+  // The conversion of an input from the datatype that requests send to
+  // the datatype of its forward() argument, each value becoming
+  // 'value * scale + offset'.
+  struct IngressConversion {
+    torch::ScalarType dtype;
+    double scale;
+    double offset;
+  };
+  // Return the conversion of input 'name', nullptr if the input is
+  // passed in the datatype that requests send.
+  const IngressConversion* InputConversion(const std::string& name) const
+  {
+    const auto it = ingress_conversions_.find(name);
+    return (it == ingress_conversions_.end()) ? nullptr : &it->second;
+  }
+
+  // Return the scale of the conversion of output 'name' to its
+  // configured datatype, 0 if the output keeps the datatype of the
+  // model output. An INT8 output holds the model output divided by the
+  // scale.
+  double EgressScale(const std::string& name) const
+  {
+    const auto it = egress_scales_.find(name);
+    return (it == egress_scales_.end()) ? 0 : it->second;
+  }
+
+  // Number of executions after which instances release input buffers
+  // that have become much larger than needed, 0 to never release.
+  int InputBufferShrinkInterval() const
+  {
+    return input_buffer_shrink_interval_;
+  }
+
  private:
+  typedef std::shared_future<std::shared_ptr<torch::jit::script::Module>>
+      SharedModuleFuture;
+
   ModelState(TRITONBACKEND_Model* triton_model);
   TRITONSERVER_Error* AutoCompleteConfig();
+  TRITONSERVER_Error* ParseParameters();
+
+  // Sort the bucket parameters and check that they can be used.
+  TRITONSERVER_Error* ValidateBuckets();
+
+  // Parse the "<output>:<k>" pairs of TOP_K_CLASSIFICATION and load the
+  // labels of those outputs.
+  TRITONSERVER_Error* ParseClassifications(const std::string& top_k);
+
+  // Return in 'model_path' the full path to the TorchScript file
+  // named 'artifact_name', checking that the file exists.
+  TRITONSERVER_Error* ResolveModelPath(
+      const std::string& artifact_name, std::string* model_path);
+
+  // Start deserializing, on the backend loader pool, the shared module
+  // of every device used by the instance groups of the model.
+  TRITONSERVER_Error* PrefetchModels();
+
+  // Return the future of the shared module for 'model_path' on
+  // 'device' with its weights on 'numa_node', if not negative. If the
+  // module is not yet being loaded then loading is started, on the
+  // loader pool if 'async' is true or else on the calling thread before
+  // returning.
+  SharedModuleFuture SharedModule(
+      const std::string& model_path, const torch::Device device,
+      const int numa_node, const bool async);
+
+  // Deserialize the TorchScript file at 'model_path' onto 'device'.
+  TRITONSERVER_Error* DeserializeModel(
+      const std::string& model_path, const torch::Device device,
+      std::shared_ptr<torch::jit::script::Module>* torch_model);
+
+  // Return the path in the model cache of the optimized module for
+  // the TorchScript file mapped in 'model_file' when loaded on
+  // 'device'. The name is derived from the content of the file, the
+  // libtorch version and the load options.
+  std::string CachedModelPath(
+      const MemoryMappedFile& model_file, const torch::Device device) const;
+
+  // Load the cached module at 'cache_path' onto 'device'. Return false
+  // if there is no usable cached module.
+  bool LoadCachedModel(
+      const std::string& cache_path, const torch::Device device,
+      std::shared_ptr<torch::jit::script::Module>* torch_model);
+
+  // Store 'torch_model' in the model cache at 'cache_path'. Failures
+  // are logged and otherwise ignored.
+  void SaveCachedModel(
+      const std::string& cache_path,
+      const torch::jit::script::Module& torch_model);
+
+  // Run the configured inference optimization passes on
+  // 'torch_model'. If a pass fails a warning is logged and the module
+  // produced by the previous pass is kept.
+  void OptimizeModel(
+      const torch::Device device,
+      std::shared_ptr<torch::jit::script::Module>* torch_model);
+
+  BackendState* backend_state_;
+
+  // Passes run on the module once after it is deserialized.
+  enum class InferenceOptimization { NONE, FREEZE, OPTIMIZE_FOR_INFERENCE };
+  InferenceOptimization inference_optimization_;
+
+  // Directory where optimized modules are cached across restarts,
+  // empty to disable the cache.
+  std::string model_cache_directory_;
+
+  // If true, all instances on the same device share the weights of a
+  // single deserialized module.
+  bool share_weights_;
+
+  // If true, shared modules are deserialized on the backend loader
+  // pool as soon as the model is initialized.
+  bool parallel_instance_loading_;
+
+  // If true, instances load the model on their first execution
+  // instead of when they are created.
+  bool lazy_instance_loading_;
+
+  int warmup_iterations_;
+  std::vector<int64_t> warmup_batch_sizes_;
+
+  int input_buffer_shrink_interval_;
+
+  std::map<std::string, Classification> classifications_;
+  std::map<std::string, double> egress_scales_;
+  std::map<std::string, IngressConversion> ingress_conversions_;
+
+  RaggedBatching ragged_batching_;
+  std::string ragged_offsets_argument_;
+  std::string padding_mask_argument_;
+  int max_padding_percent_;
+
+  std::vector<int64_t> batch_buckets_;
+  std::vector<int64_t> sequence_buckets_;
+
+  int micro_batch_size_;
+
+  int intra_op_thread_count_;
+  ThreadsByBatch intra_op_threads_by_batch_;
+  bool learn_intra_op_threads_;
+
+  // If true, CPU instances are placed on the NUMA nodes in turn.
+  bool numa_placement_;
+  std::atomic<size_t> next_numa_node_;
+
+  bool async_execution_;
+  int async_worker_count_;
+  std::unique_ptr<WorkStealingPool> worker_pool_;
+  int executor_thread_count_;
+
+  // Modules deserialized, or being deserialized, by this model keyed
+  // by model path and device. Only used when 'share_weights_' is true.
+  std::mutex load_mu_;
+  std::map<std::string, SharedModuleFuture> shared_modules_;
+  bool has_shared_cuda_module_;
 };
 
 
@@ -120,91 +578,977 @@ ModelState::Create(TRITONBACKEND_Model* triton_model, ModelState** state)
         triton_model, 1 /* config_version */, message));
   }
 
+  // Backend-wide settings provide the defaults for some parameters.
+  TRITONBACKEND_Backend* backend;
+  RETURN_IF_ERROR(TRITONBACKEND_ModelBackend(triton_model, &backend));
+  void* vbackendstate;
+  RETURN_IF_ERROR(TRITONBACKEND_BackendState(backend, &vbackendstate));
+  (*state)->backend_state_ = reinterpret_cast<BackendState*>(vbackendstate);
+
+  RETURN_IF_ERROR((*state)->ParseParameters());
+
+  if ((*state)->parallel_instance_loading_) {
+    RETURN_IF_ERROR((*state)->PrefetchModels());
+  }
+
   return nullptr;  // success
 }
 
 ModelState::ModelState(TRITONBACKEND_Model* triton_model)
-    : BackendModel(triton_model)
+    : BackendModel(triton_model), backend_state_(nullptr),
+      inference_optimization_(InferenceOptimization::NONE),
+      share_weights_(true), parallel_instance_loading_(false),
+      lazy_instance_loading_(false), warmup_iterations_(0),
+      input_buffer_shrink_interval_(1000),
+      ragged_batching_(RaggedBatching::CONCATENATE), max_padding_percent_(25),
+      micro_batch_size_(0), intra_op_thread_count_(0),
+      learn_intra_op_threads_(false),
+      numa_placement_(false), next_numa_node_(0),
+      async_execution_(false), async_worker_count_(2),
+      executor_thread_count_(1), has_shared_cuda_module_(false)
 {
 }
 
-/* 读取PyTorch模型文件 */
+ModelState::~ModelState()
+{
+  // Loads running on the loader pool refer to this object so they
+  // must be complete before it goes away. A failing load removes
+  // itself from the map, so the map is only read under the lock.
+  std::vector<SharedModuleFuture> loads;
+  {
+    std::lock_guard<std::mutex> lk(load_mu_);
+    for (auto& pr : shared_modules_) {
+      loads.push_back(pr.second);
+    }
+  }
+  for (auto& load : loads) {
+    load.wait();
+  }
+  shared_modules_.clear();
+#ifdef TRITON_ENABLE_GPU
+  if (has_shared_cuda_module_) {
+    c10::cuda::CUDACachingAllocator::emptyCache();
+  }
+#endif  // TRITON_ENABLE_GPU
+}
+
 TRITONSERVER_Error*
-ModelState::LoadModel(
-    const std::string& artifact_name, const torch::Device device,
-    std::string* model_path,
-    std::unique_ptr<torch::jit::script::Module>* torch_model)
+ModelState::ValidateBuckets()
 {
-  // Find the TorchScript file that describes the model. If the model
-  // configuration doesn't have an explicit model file specified then
-  // use the default name ("model.pt").
-  /* 生成PyTorch模型文件路径，并检查模型是否存在 */
-  std::string cc_model_filename = artifact_name;
-  if (cc_model_filename.empty()) {
-    cc_model_filename = "model.pt";
+  std::sort(batch_buckets_.begin(), batch_buckets_.end());
+  batch_buckets_.erase(
+      std::unique(batch_buckets_.begin(), batch_buckets_.end()),
+      batch_buckets_.end());
+  if (!batch_buckets_.empty()) {
+    if (MaxBatchSize() == 0) {
+      return TRITONSERVER_ErrorNew(
+          TRITONSERVER_ERROR_INVALID_ARG,
+          (std::string("BATCH_BUCKETS requires model '") + Name() +
+           "' to support batching")
+              .c_str());
+    }
+    if ((batch_buckets_.front() < 1) ||
+        (batch_buckets_.back() > MaxBatchSize())) {
+      return TRITONSERVER_ErrorNew(
+          TRITONSERVER_ERROR_INVALID_ARG,
+          (std::string("BATCH_BUCKETS of model '") + Name() +
+           "' must be between 1 and the max batch size " +
+           std::to_string(MaxBatchSize()))
+              .c_str());
+    }
   }
 
-  *model_path = JoinPath(
-      {RepositoryPath(), std::to_string(Version()), cc_model_filename});
+  std::sort(sequence_buckets_.begin(), sequence_buckets_.end());
+  sequence_buckets_.erase(
+      std::unique(sequence_buckets_.begin(), sequence_buckets_.end()),
+      sequence_buckets_.end());
+  if (!sequence_buckets_.empty()) {
+    if (sequence_buckets_.front() < 1) {
+      return TRITONSERVER_ErrorNew(
+          TRITONSERVER_ERROR_INVALID_ARG,
+          (std::string("SEQUENCE_BUCKETS of model '") + Name() +
+           "' must be positive")
+              .c_str());
+    }
+    if (ragged_batching_ != RaggedBatching::PAD) {
+      LOG_MESSAGE(
+          TRITONSERVER_LOG_WARN,
+          (std::string("SEQUENCE_BUCKETS of model '") + Name() +
+           "' only apply when RAGGED_BATCHING is 'pad', ignoring them")
+              .c_str());
+      sequence_buckets_.clear();
+    }
+  }
 
-  {
-    bool exists;
-    RETURN_IF_ERROR(FileExists(*model_path, &exists));
-    RETURN_ERROR_IF_FALSE(
-        exists, TRITONSERVER_ERROR_UNAVAILABLE,
-        std::string("unable to find '") + *model_path +
-            "' for model instance '" + Name() + "'");
+  return nullptr;  // success
+}
+
+TRITONSERVER_Error*
+ModelState::ParseClassifications(const std::string& top_k)
+{
+  for (const auto& item : SplitString(top_k, ',')) {
+    const size_t pos = item.rfind(':');
+    int64_t k = 0;
+    if (pos != std::string::npos) {
+      RETURN_IF_ERROR(ParseLongLongValue(item.substr(pos + 1), &k));
+    }
+    if (k < 1) {
+      return TRITONSERVER_ErrorNew(
+          TRITONSERVER_ERROR_INVALID_ARG,
+          (std::string("TOP_K_CLASSIFICATION for model '") + Name() +
+           "' must be a list of <output>:<k> pairs with positive k, got '" +
+           item + "'")
+              .c_str());
+    }
+    classifications_[item.substr(0, pos)].k = k;
+  }
+  if (classifications_.empty()) {
+    return nullptr;  // success
   }
 
-  /* 开始读取模型文件 */
-  // Serialize the torch model to string
-  std::string model_data_str;
-  RETURN_IF_ERROR(ReadTextFile(*model_path, &model_data_str));
+  // Labels are read from the 'label_filename' of the output, one per
+  // line in class order.
+  triton::common::TritonJson::Value ios;
+  RETURN_IF_ERROR(model_config_.MemberAsArray("output", &ios));
+  size_t found = 0;
+  for (size_t i = 0; i < ios.ArraySize(); i++) {
+    triton::common::TritonJson::Value io;
+    RETURN_IF_ERROR(ios.IndexAsObject(i, &io));
+    std::string io_name;
+    RETURN_IF_ERROR(io.MemberAsString("name", &io_name));
+    auto it = classifications_.find(io_name);
+    if (it == classifications_.end()) {
+      continue;
+    }
+    ++found;
 
-  try {
-    std::istringstream model_stream(model_data_str);
-    /* 从string流读入模型并创建为Torch JIT模型对象, 通过unique指针返回 */
-    torch_model->reset(
-        new torch::jit::Module(torch::jit::load(model_stream, device)));
+    std::string label_filename;
+    if (io.Find("label_filename")) {
+      RETURN_IF_ERROR(io.MemberAsString("label_filename", &label_filename));
+    }
+    if (label_filename.empty()) {
+      continue;
+    }
+    std::string labels;
+    RETURN_IF_ERROR(
+        ReadTextFile(JoinPath({RepositoryPath(), label_filename}), &labels));
+    size_t start = 0;
+    while (start < labels.size()) {
+      size_t end = labels.find('\n', start);
+      if (end == std::string::npos) {
+        end = labels.size();
+      }
+      std::string label = labels.substr(start, end - start);
+      if (!label.empty() && (label.back() == '\r')) {
+        label.pop_back();
+      }
+      it->second.labels.push_back(label);
+      start = end + 1;
+    }
   }
-  catch (const std::exception& ex) {
+  if (found != classifications_.size()) {
     return TRITONSERVER_ErrorNew(
-        TRITONSERVER_ERROR_INTERNAL,
-        ("failed to load model '" + Name() + "': " + ex.what()).c_str());
+        TRITONSERVER_ERROR_INVALID_ARG,
+        (std::string("TOP_K_CLASSIFICATION of model '") + Name() +
+         "' names an output that is not in the model configuration")
+            .c_str());
   }
 
   return nullptr;  // success
 }
 
 TRITONSERVER_Error*
-ModelState::AutoCompleteConfig()
+ModelState::ParseParameters()
 {
-  // Auto-complete configuration is not supported since PyTorch does not
-  // store/capture sufficient model metadata so just log error instead.
+  model_cache_directory_ = backend_state_->ModelCacheDirectory();
+
+  triton::common::TritonJson::Value params;
+  if (model_config_.Find("parameters", &params)) {
+    RETURN_IF_ERROR(
+        ParseOptionalParameter(params, "SHARE_WEIGHTS", &share_weights_));
+    RETURN_IF_ERROR(ParseOptionalParameter(
+        params, "PARALLEL_INSTANCE_LOADING", &parallel_instance_loading_));
+    RETURN_IF_ERROR(ParseOptionalParameter(
+        params, "LAZY_INSTANCE_LOADING", &lazy_instance_loading_));
+
+    RETURN_IF_ERROR(ParseOptionalParameter(
+        params, "MODEL_CACHE_DIRECTORY", &model_cache_directory_));
+    RETURN_IF_ERROR(ParseOptionalParameter(
+        params, "WARMUP_ITERATIONS", &warmup_iterations_));
+    RETURN_IF_ERROR(ParseOptionalParameter(
+        params, "WARMUP_BATCH_SIZES", &warmup_batch_sizes_));
+    std::string ragged_batching;
+    RETURN_IF_ERROR(
+        ParseOptionalParameter(params, "RAGGED_BATCHING", &ragged_batching));
+    if (ragged_batching.empty() || (ragged_batching == "concatenate")) {
+      ragged_batching_ = RaggedBatching::CONCATENATE;
+    } else if (ragged_batching == "pad") {
+      ragged_batching_ = RaggedBatching::PAD;
+    } else {
+      return TRITONSERVER_ErrorNew(
+          TRITONSERVER_ERROR_INVALID_ARG,
+          (std::string("unknown RAGGED_BATCHING '") + ragged_batching +
+           "' for model '" + Name() + "', expecting 'concatenate' or 'pad'")
+              .c_str());
+    }
+    RETURN_IF_ERROR(ParseOptionalParameter(
+        params, "RAGGED_OFFSETS_ARGUMENT", &ragged_offsets_argument_));
+    RETURN_IF_ERROR(ParseOptionalParameter(
+        params, "PADDING_MASK_ARGUMENT", &padding_mask_argument_));
+    RETURN_IF_ERROR(ParseOptionalParameter(
+        params, "MAX_PADDING_PERCENT", &max_padding_percent_));
+    RETURN_IF_ERROR(
+        ParseOptionalParameter(params, "BATCH_BUCKETS", &batch_buckets_));
+    RETURN_IF_ERROR(ParseOptionalParameter(
+        params, "SEQUENCE_BUCKETS", &sequence_buckets_));
+    if ((max_padding_percent_ < 0) || (max_padding_percent_ > 100)) {
+      return TRITONSERVER_ErrorNew(
+          TRITONSERVER_ERROR_INVALID_ARG,
+          (std::string("MAX_PADDING_PERCENT for model '") + Name() +
+           "' must be between 0 and 100")
+              .c_str());
+    }
+    RETURN_IF_ERROR(ParseOptionalParameter(
+        params, "INPUT_BUFFER_SHRINK_INTERVAL",
+        &input_buffer_shrink_interval_));
+    if (input_buffer_shrink_interval_ < 0) {
+      return TRITONSERVER_ErrorNew(
+          TRITONSERVER_ERROR_INVALID_ARG,
+          (std::string("INPUT_BUFFER_SHRINK_INTERVAL for model '") + Name() +
+           "' must not be negative")
+              .c_str());
+    }
+    RETURN_IF_ERROR(ParseOptionalParameter(
+        params, "MICRO_BATCH_SIZE", &micro_batch_size_));
+    if (micro_batch_size_ < 0) {
+      return TRITONSERVER_ErrorNew(
+          TRITONSERVER_ERROR_INVALID_ARG,
+          (std::string("MICRO_BATCH_SIZE for model '") + Name() +
+           "' must not be negative")
+              .c_str());
+    }
+    RETURN_IF_ERROR(ParseOptionalParameter(
+        params, "INTRA_OP_THREAD_COUNT", &intra_op_thread_count_));
+    if (intra_op_thread_count_ < 0) {
+      return TRITONSERVER_ErrorNew(
+          TRITONSERVER_ERROR_INVALID_ARG,
+          (std::string("INTRA_OP_THREAD_COUNT for model '") + Name() +
+           "' must not be negative")
+              .c_str());
+    }
+    std::string threads_by_batch;
+    RETURN_IF_ERROR(ParseOptionalParameter(
+        params, "INTRA_OP_THREADS_BY_BATCH", &threads_by_batch));
+    if (threads_by_batch == "auto") {
+      learn_intra_op_threads_ = true;
+    } else {
+      for (const auto& item : SplitString(threads_by_batch, ',')) {
+        const std::vector<std::string> pair = SplitString(item, ':');
+        int64_t batch_size = 0;
+        int thread_count = 0;
+        if (pair.size() == 2) {
+          RETURN_IF_ERROR(ParseLongLongValue(pair[0], &batch_size));
+          RETURN_IF_ERROR(ParseIntValue(pair[1], &thread_count));
+        }
+        if ((batch_size < 1) || (thread_count < 1)) {
+          return TRITONSERVER_ErrorNew(
+              TRITONSERVER_ERROR_INVALID_ARG,
+              (std::string("INTRA_OP_THREADS_BY_BATCH for model '") +
+               Name() + "' must be 'auto' or a list of positive "
+               "<batch size>:<thread count> pairs, got '" + item + "'")
+                  .c_str());
+        }
+        intra_op_threads_by_batch_.emplace_back(batch_size, thread_count);
+      }
+      std::sort(
+          intra_op_threads_by_batch_.begin(),
+          intra_op_threads_by_batch_.end());
+    }
+
+    std::string numa_placement;
+    RETURN_IF_ERROR(ParseOptionalParameter(
+        params, "NUMA_PLACEMENT", &numa_placement));
+    if (numa_placement.empty() || (numa_placement == "none")) {
+      numa_placement_ = false;
+    } else if (numa_placement == "round_robin") {
+      numa_placement_ = true;
+    } else {
+      return TRITONSERVER_ErrorNew(
+          TRITONSERVER_ERROR_INVALID_ARG,
+          (std::string("unknown NUMA_PLACEMENT '") + numa_placement +
+           "' for model '" + Name() + "', expecting 'none' or 'round_robin'")
+              .c_str());
+    }
+    RETURN_IF_ERROR(ParseOptionalParameter(
+        params, "ASYNC_EXECUTION", &async_execution_));
+    RETURN_IF_ERROR(ParseOptionalParameter(
+        params, "ASYNC_WORKER_COUNT", &async_worker_count_));
+    if (async_worker_count_ < 1) {
+      return TRITONSERVER_ErrorNew(
+          TRITONSERVER_ERROR_INVALID_ARG,
+          (std::string("ASYNC_WORKER_COUNT for model '") + Name() +
+           "' must be at least 1")
+              .c_str());
+    }
+    RETURN_IF_ERROR(ParseOptionalParameter(
+        params, "EXECUTOR_THREAD_COUNT", &executor_thread_count_));
+    if (executor_thread_count_ < 1) {
+      return TRITONSERVER_ErrorNew(
+          TRITONSERVER_ERROR_INVALID_ARG,
+          (std::string("EXECUTOR_THREAD_COUNT for model '") + Name() +
+           "' must be at least 1")
+              .c_str());
+    }
+
+    std::string top_k;
+    RETURN_IF_ERROR(
+        ParseOptionalParameter(params, "TOP_K_CLASSIFICATION", &top_k));
+    RETURN_IF_ERROR(ParseClassifications(top_k));
+
+    std::string egress_conversion;
+    RETURN_IF_ERROR(ParseOptionalParameter(
+        params, "EGRESS_CONVERSION", &egress_conversion));
+    for (const auto& item : SplitString(egress_conversion, ',')) {
+      const size_t pos = item.find(':');
+      double scale = 1;
+      if (pos != std::string::npos) {
+        RETURN_IF_ERROR(ParseDoubleValue(item.substr(pos + 1), &scale));
+      }
+      if ((pos == 0) || !(scale > 0)) {
+        return TRITONSERVER_ErrorNew(
+            TRITONSERVER_ERROR_INVALID_ARG,
+            (std::string("EGRESS_CONVERSION for model '") + Name() +
+             "' must be a list of <output>[:<scale>] with positive scale, "
+             "got '" +
+             item + "'")
+                .c_str());
+      }
+      egress_scales_[item.substr(0, pos)] = scale;
+    }
+
+    std::string ingress_conversion;
+    RETURN_IF_ERROR(ParseOptionalParameter(
+        params, "INGRESS_CONVERSION", &ingress_conversion));
+    for (const auto& item : SplitString(ingress_conversion, ',')) {
+      const std::vector<std::string> fields = SplitString(item, ':');
+      IngressConversion conversion{torch::kFloat, 1, 0};
+      bool valid = (fields.size() >= 2) && (fields.size() <= 4);
+      if (valid) {
+        const auto pr = ModelConfigDataTypeToTorchType("TYPE_" + fields[1]);
+        conversion.dtype = pr.second;
+        valid = pr.first && ((pr.second == torch::kHalf) ||
+                             (pr.second == torch::kBFloat16) ||
+                             (pr.second == torch::kFloat) ||
+                             (pr.second == torch::kDouble));
+      }
+      if (valid && (fields.size() >= 3)) {
+        RETURN_IF_ERROR(ParseDoubleValue(fields[2], &conversion.scale));
+      }
+      if (valid && (fields.size() == 4)) {
+        RETURN_IF_ERROR(ParseDoubleValue(fields[3], &conversion.offset));
+      }
+      if (!valid) {
+        return TRITONSERVER_ErrorNew(
+            TRITONSERVER_ERROR_INVALID_ARG,
+            (std::string("INGRESS_CONVERSION for model '") + Name() +
+             "' must be a list of <input>:<FP16|BF16|FP32|FP64>"
+             "[:<scale>[:<offset>]], got '" +
+             item + "'")
+                .c_str());
+      }
+      ingress_conversions_[fields[0]] = conversion;
+    }
+
+    std::string optimization;
+    RETURN_IF_ERROR(ParseOptionalParameter(
+        params, "INFERENCE_OPTIMIZATION", &optimization));
+    if (optimization.empty() || (optimization == "none")) {
+      inference_optimization_ = InferenceOptimization::NONE;
+    } else if (optimization == "freeze") {
+      inference_optimization_ = InferenceOptimization::FREEZE;
+    } else if (optimization == "optimize_for_inference") {
+      inference_optimization_ = InferenceOptimization::OPTIMIZE_FOR_INFERENCE;
+    } else {
+      return TRITONSERVER_ErrorNew(
+          TRITONSERVER_ERROR_INVALID_ARG,
+          (std::string("unknown INFERENCE_OPTIMIZATION '") + optimization +
+           "' for model '" + Name() +
+           "', expecting 'none', 'freeze' or 'optimize_for_inference'")
+              .c_str());
+    }
+  }
+
+  RETURN_IF_ERROR(ValidateBuckets());
+
+  if ((micro_batch_size_ > 0) && (MaxBatchSize() == 0)) {
+    LOG_MESSAGE(
+        TRITONSERVER_LOG_WARN,
+        (std::string("MICRO_BATCH_SIZE requires batching, ignoring it for "
+                     "model '") +
+         Name() + "'")
+            .c_str());
+    micro_batch_size_ = 0;
+  }
+  if ((micro_batch_size_ > 0) && async_execution_) {
+    LOG_MESSAGE(
+        TRITONSERVER_LOG_WARN,
+        (std::string("MICRO_BATCH_SIZE doesn't apply to ASYNC_EXECUTION, "
+                     "ignoring it for model '") +
+         Name() + "'")
+            .c_str());
+    micro_batch_size_ = 0;
+  }
+  // Steps of a sequence must execute in order, which the worker pools
+  // don't guarantee.
+  if ((async_execution_ || (executor_thread_count_ > 1)) &&
+      model_config_.Find("sequence_batching")) {
+    LOG_MESSAGE(
+        TRITONSERVER_LOG_WARN,
+        (std::string("ASYNC_EXECUTION and EXECUTOR_THREAD_COUNT don't apply "
+                     "to sequence batching, ignoring them for model '") +
+         Name() + "'")
+            .c_str());
+    async_execution_ = false;
+    executor_thread_count_ = 1;
+  }
+  if ((executor_thread_count_ > 1) && async_execution_) {
+    LOG_MESSAGE(
+        TRITONSERVER_LOG_WARN,
+        (std::string("EXECUTOR_THREAD_COUNT doesn't apply to "
+                     "ASYNC_EXECUTION, ignoring it for model '") +
+         Name() + "'")
+            .c_str());
+    executor_thread_count_ = 1;
+  }
+  if ((micro_batch_size_ > 0) && (executor_thread_count_ > 1)) {
+    LOG_MESSAGE(
+        TRITONSERVER_LOG_WARN,
+        (std::string("MICRO_BATCH_SIZE doesn't apply to "
+                     "EXECUTOR_THREAD_COUNT, ignoring it for model '") +
+         Name() + "'")
+            .c_str());
+    micro_batch_size_ = 0;
+  }
+  if (async_execution_) {
+    worker_pool_.reset(new WorkStealingPool(async_worker_count_));
+  }
+  if (learn_intra_op_threads_ && (warmup_iterations_ <= 0)) {
+    LOG_MESSAGE(
+        TRITONSERVER_LOG_WARN,
+        (std::string("INTRA_OP_THREADS_BY_BATCH 'auto' requires "
+                     "WARMUP_ITERATIONS, ignoring it for model '") +
+         Name() + "'")
+            .c_str());
+    learn_intra_op_threads_ = false;
+  }
+  if (numa_placement_ && backend_state_->NumaNodes().empty()) {
+    LOG_MESSAGE(
+        TRITONSERVER_LOG_WARN,
+        (std::string("NUMA topology is not available, instances of model '") +
+         Name() + "' are not placed on NUMA nodes")
+            .c_str());
+    numa_placement_ = false;
+  }
+
+  if (parallel_instance_loading_ && !share_weights_) {
+    LOG_MESSAGE(
+        TRITONSERVER_LOG_WARN,
+        (std::string("PARALLEL_INSTANCE_LOADING requires SHARE_WEIGHTS, "
+                     "instances of model '") +
+         Name() + "' will be loaded serially")
+            .c_str());
+    parallel_instance_loading_ = false;
+  }
+
   LOG_MESSAGE(
-      TRITONSERVER_LOG_WARN,
-      (std::string("skipping model configuration auto-complete for '") +
-       Name() + "': not supported for pytorch backend")
+      TRITONSERVER_LOG_INFO,
+      (std::string("Weight sharing across instances is ") +
+       (share_weights_ ? "enabled" : "disabled") +
+       ", parallel instance loading is " +
+       (parallel_instance_loading_ ? "enabled" : "disabled") +
+       ", lazy instance loading is " +
+       (lazy_instance_loading_ ? "enabled" : "disabled") + " for model '" +
+       Name() + "'")
           .c_str());
 
   return nullptr;  // success
 }
 
+TRITONSERVER_Error*
+ModelState::PrefetchModels()
+{
+  std::string artifact_name;
+  if (model_config_.Find("default_model_filename")) {
+    RETURN_IF_ERROR(
+        model_config_.MemberAsString("default_model_filename", &artifact_name));
+  }
 
-//
-// ModelInstanceState
-//
-// State associated with a model instance. An object of this class is
-// created and associated with each TRITONBACKEND_ModelInstance.
-//
-class ModelInstanceState : public BackendModelInstance {
-  /* ModelInstanceState继承BackendModelInstance类，基类中包含了诸多与某个特定model instance相关的信息，包括：*/
-  /* 指向instance对应BackendModel的指针，instance的类型(GPU/CPU)，运行设备的id，模型文件的路径等 */
-  /* 这个类的对象将依附于TRITONBACKEND_ModelInstance对象，执行实际的输入数据准备、模型前行推理和输出数据收集和发送等步骤， */
-  /* 是Backend在某个设备上的实际executor */
- public:
-  static TRITONSERVER_Error* Create(
-      ModelState* model_state,
+  std::string model_path;
+  RETURN_IF_ERROR(ResolveModelPath(artifact_name, &model_path));
+
+  // The instance groups have been normalized by Triton so every group
+  // has an explicit kind and, for GPU groups, explicit devices.
+  int64_t cpu_instance_count = 0;
+  triton::common::TritonJson::Value groups;
+  if (!model_config_.Find("instance_group", &groups)) {
+    return nullptr;  // success
+  }
+
+  for (size_t i = 0; i < groups.ArraySize(); ++i) {
+    triton::common::TritonJson::Value group;
+    RETURN_IF_ERROR(groups.IndexAsObject(i, &group));
+    std::string kind;
+    RETURN_IF_ERROR(group.MemberAsString("kind", &kind));
+
+    if (kind == "KIND_CPU") {
+      int64_t count = 1;
+      if (group.Find("count")) {
+        RETURN_IF_ERROR(group.MemberAsInt("count", &count));
+      }
+      cpu_instance_count += count;
+    } else if (kind == "KIND_GPU") {
+      triton::common::TritonJson::Value gpus;
+      if (group.Find("gpus", &gpus)) {
+        for (size_t j = 0; j < gpus.ArraySize(); ++j) {
+          int64_t gpu;
+          RETURN_IF_ERROR(gpus.IndexAsInt(j, &gpu));
+          SharedModule(
+              model_path, torch::Device(torch::kCUDA, gpu), -1 /* numa_node */,
+              true /* async */);
+        }
+      }
+    }
+  }
+
+  // CPU instances placed on NUMA nodes use the module of their node.
+  if (cpu_instance_count > 0) {
+    if (numa_placement_) {
+      const std::vector<NumaNode>& nodes = backend_state_->NumaNodes();
+      for (int64_t i = 0;
+           i < std::min(cpu_instance_count, int64_t(nodes.size())); ++i) {
+        SharedModule(
+            model_path, torch::Device(torch::kCPU), nodes[i].id,
+            true /* async */);
+      }
+    } else {
+      SharedModule(
+          model_path, torch::Device(torch::kCPU), -1 /* numa_node */,
+          true /* async */);
+    }
+  }
+
+  return nullptr;  // success
+}
+
+const NumaNode*
+ModelState::NextNumaNode()
+{
+  if (!numa_placement_) {
+    return nullptr;
+  }
+  const std::vector<NumaNode>& nodes = backend_state_->NumaNodes();
+  return &nodes[next_numa_node_++ % nodes.size()];
+}
+
+ModelState::SharedModuleFuture
+ModelState::SharedModule(
+    const std::string& model_path, const torch::Device device,
+    const int numa_node, const bool async)
+{
+  std::shared_ptr<
+      std::packaged_task<std::shared_ptr<torch::jit::script::Module>()>>
+      task;
+  SharedModuleFuture future;
+  {
+    std::lock_guard<std::mutex> lk(load_mu_);
+    std::string key = model_path + "@" + device.str();
+    if (numa_node >= 0) {
+      key += "#" + std::to_string(numa_node);
+    }
+    auto itr = shared_modules_.find(key);
+    if (itr != shared_modules_.end()) {
+      return itr->second;
+    }
+
+    // A TRITONSERVER_Error can only be returned to one caller so a
+    // failure is carried in the future as an exception and converted
+    // back to an error by each caller. The failed load is forgotten so
+    // that later callers try again.
+    task.reset(
+        new std::packaged_task<std::shared_ptr<torch::jit::script::Module>()>(
+            [this, key, model_path, device, numa_node] {
+              ScopedThreadMemoryNode memory_node(numa_node);
+              std::shared_ptr<torch::jit::script::Module> module;
+              TRITONSERVER_Error* err =
+                  DeserializeModel(model_path, device, &module);
+              if (err != nullptr) {
+                const std::string msg = TRITONSERVER_ErrorMessage(err);
+                TRITONSERVER_ErrorDelete(err);
+                {
+                  std::lock_guard<std::mutex> lk(load_mu_);
+                  shared_modules_.erase(key);
+                }
+                throw std::runtime_error(msg);
+              }
+              return module;
+            }));
+    future = task->get_future().share();
+    shared_modules_.emplace(key, future);
+    has_shared_cuda_module_ |= device.is_cuda();
+  }
+
+  if (async) {
+    backend_state_->LoaderPool()->Enqueue([task] { (*task)(); });
+  } else {
+    (*task)();
+  }
+
+  return future;
+}
+
+/* 读取PyTorch模型文件 */
+TRITONSERVER_Error*
+ModelState::LoadModel(
+    const std::string& artifact_name, const torch::Device device,
+    const int numa_node, std::string* model_path,
+    std::unique_ptr<torch::jit::script::Module>* torch_model)
+{
+  RETURN_IF_ERROR(ResolveModelPath(artifact_name, model_path));
+
+  if (!share_weights_) {
+    ScopedThreadMemoryNode memory_node(numa_node);
+    std::shared_ptr<torch::jit::script::Module> module;
+    RETURN_IF_ERROR(DeserializeModel(*model_path, device, &module));
+    torch_model->reset(new torch::jit::Module(*module));
+    return nullptr;  // success
+  }
+
+  // Wait for the shared module, which may already be loading on the
+  // loader pool if the model prefetched it.
+  std::shared_ptr<torch::jit::script::Module> shared_module;
+  try {
+    shared_module =
+        SharedModule(*model_path, device, numa_node, false /* async */)
+            .get();
+  }
+  catch (const std::exception& ex) {
+    return TRITONSERVER_ErrorNew(TRITONSERVER_ERROR_INTERNAL, ex.what());
+  }
+
+  // An in-place clone gets its own module type and methods, and so
+  // its own graph executors, but its attributes refer to the same
+  // tensors as the shared module so no weights are copied.
+  try {
+    torch_model->reset(new torch::jit::Module(shared_module->clone(true)));
+  }
+  catch (const std::exception& ex) {
+    return TRITONSERVER_ErrorNew(
+        TRITONSERVER_ERROR_INTERNAL,
+        ("failed to clone model '" + Name() + "': " + ex.what()).c_str());
+  }
+
+  return nullptr;  // success
+}
+
+TRITONSERVER_Error*
+ModelState::ResolveModelPath(
+    const std::string& artifact_name, std::string* model_path)
+{
+  // Find the TorchScript file that describes the model. If the model
+  // configuration doesn't have an explicit model file specified then
+  // use the default name ("model.pt").
+  /* 生成PyTorch模型文件路径，并检查模型是否存在 */
+  std::string cc_model_filename = artifact_name;
+  if (cc_model_filename.empty()) {
+    cc_model_filename = "model.pt";
+  }
+
+  *model_path = JoinPath(
+      {RepositoryPath(), std::to_string(Version()), cc_model_filename});
+
+  {
+    bool exists;
+    RETURN_IF_ERROR(FileExists(*model_path, &exists));
+    RETURN_ERROR_IF_FALSE(
+        exists, TRITONSERVER_ERROR_UNAVAILABLE,
+        std::string("unable to find '") + *model_path +
+            "' for model instance '" + Name() + "'");
+  }
+
+  return nullptr;  // success
+}
+
+TRITONSERVER_Error*
+ModelState::DeserializeModel(
+    const std::string& model_path, const torch::Device device,
+    std::shared_ptr<torch::jit::script::Module>* torch_model)
+{
+  // Map the TorchScript file and let the deserializer read the
+  // archive records straight out of the mapping. This avoids holding
+  // an extra in-memory copy of the whole file while the module is
+  // being loaded so peak memory is roughly the size of the weights.
+  const auto load_start = std::chrono::steady_clock::now();
+  uint64_t rss_before, peak_rss_before;
+  GetProcessMemoryUsage(&rss_before, &peak_rss_before);
+
+  std::unique_ptr<MemoryMappedFile> model_file;
+  RETURN_IF_ERROR(MemoryMappedFile::Create(model_path, &model_file));
+
+  // Only the result of the optimization passes is worth caching, an
+  // unoptimized module is identical to the model file.
+  std::string cache_path;
+  bool from_cache = false;
+  if (!model_cache_directory_.empty() &&
+      (inference_optimization_ != InferenceOptimization::NONE)) {
+    cache_path = CachedModelPath(*model_file, device);
+    from_cache = LoadCachedModel(cache_path, device, torch_model);
+  }
+
+  if (!from_cache) {
+    try {
+      torch_model->reset(new torch::jit::Module(
+          torch::jit::load(model_file->NewReadAdapter(), device)));
+    }
+    catch (const std::exception& ex) {
+      return TRITONSERVER_ErrorNew(
+          TRITONSERVER_ERROR_INTERNAL,
+          ("failed to load model '" + Name() + "': " + ex.what()).c_str());
+    }
+  }
+
+  const size_t model_file_size = model_file->Size();
+  model_file.reset();
+
+  const auto load_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                           std::chrono::steady_clock::now() - load_start)
+                           .count();
+  uint64_t rss_after, peak_rss_after;
+  GetProcessMemoryUsage(&rss_after, &peak_rss_after);
+
+  LOG_MESSAGE(
+      TRITONSERVER_LOG_INFO,
+      (std::string("loaded '") + (from_cache ? cache_path : model_path) +
+       "' (" + std::to_string(model_file_size) + " bytes) for model '" +
+       Name() + "' on " + device.str() + " in " + std::to_string(load_ms) +
+       " ms: RSS " + std::to_string(rss_before) + " -> " +
+       std::to_string(rss_after) + " bytes, peak RSS " +
+       std::to_string(peak_rss_before) + " -> " +
+       std::to_string(peak_rss_after) + " bytes")
+          .c_str());
+
+  if (!from_cache) {
+    OptimizeModel(device, torch_model);
+    if (!cache_path.empty()) {
+      SaveCachedModel(cache_path, **torch_model);
+    }
+  }
+
+  return nullptr;  // success
+}
+
+std::string
+ModelState::CachedModelPath(
+    const MemoryMappedFile& model_file, const torch::Device device) const
+{
+  const std::string options =
+      std::string("libtorch ") + std::to_string(TORCH_VERSION_MAJOR) + "." +
+      std::to_string(TORCH_VERSION_MINOR) + "." +
+      std::to_string(TORCH_VERSION_PATCH) + ", optimization " +
+      std::to_string(static_cast<int>(inference_optimization_)) +
+      ", device " + device.str();
+
+  const uint64_t key = HashBytes(model_file.Data(), model_file.Size()) ^
+                       (HashBytes(options.data(), options.size()) *
+                        0x9e3779b97f4a7c15ULL);
+
+  char key_str[17];
+  snprintf(
+      key_str, sizeof(key_str), "%016llx",
+      static_cast<unsigned long long>(key));
+
+  return JoinPath({model_cache_directory_, Name() + "-" + key_str + ".pt"});
+}
+
+bool
+ModelState::LoadCachedModel(
+    const std::string& cache_path, const torch::Device device,
+    std::shared_ptr<torch::jit::script::Module>* torch_model)
+{
+  bool exists = false;
+  TRITONSERVER_Error* err = FileExists(cache_path, &exists);
+  if (err != nullptr) {
+    TRITONSERVER_ErrorDelete(err);
+    return false;
+  }
+  if (!exists) {
+    return false;
+  }
+
+  std::unique_ptr<MemoryMappedFile> cache_file;
+  err = MemoryMappedFile::Create(cache_path, &cache_file);
+  if (err == nullptr) {
+    try {
+      torch_model->reset(new torch::jit::Module(
+          torch::jit::load(cache_file->NewReadAdapter(), device)));
+      return true;
+    }
+    catch (const std::exception& ex) {
+      err = TRITONSERVER_ErrorNew(TRITONSERVER_ERROR_INTERNAL, ex.what());
+    }
+  }
+
+  LOG_MESSAGE(
+      TRITONSERVER_LOG_WARN,
+      (std::string("ignoring cached module '") + cache_path + "' for model '" +
+       Name() + "': " + TRITONSERVER_ErrorMessage(err))
+          .c_str());
+  TRITONSERVER_ErrorDelete(err);
+
+  return false;
+}
+
+void
+ModelState::SaveCachedModel(
+    const std::string& cache_path,
+    const torch::jit::script::Module& torch_model)
+{
+  if ((mkdir(model_cache_directory_.c_str(), 0755) != 0) &&
+      (errno != EEXIST)) {
+    LOG_MESSAGE(
+        TRITONSERVER_LOG_WARN,
+        (std::string("failed to create model cache directory '") +
+         model_cache_directory_ + "': " + strerror(errno))
+            .c_str());
+    return;
+  }
+
+  // Write to a temporary file and rename it so that concurrent
+  // servers never see a partially written module. Loads of the same
+  // module, e.g. one per NUMA node, may save it at the same time so
+  // every writer has its own temporary file.
+  static std::atomic<uint64_t> tmp_counter(0);
+  const std::string tmp_path =
+      cache_path + ".tmp." + std::to_string(static_cast<int64_t>(getpid())) +
+      "." + std::to_string(tmp_counter++);
+  try {
+    torch_model.save(tmp_path);
+  }
+  catch (const std::exception& ex) {
+    LOG_MESSAGE(
+        TRITONSERVER_LOG_WARN,
+        (std::string("failed to cache optimized module of model '") + Name() +
+         "': " + ex.what())
+            .c_str());
+    unlink(tmp_path.c_str());
+    return;
+  }
+
+  if (rename(tmp_path.c_str(), cache_path.c_str()) != 0) {
+    LOG_MESSAGE(
+        TRITONSERVER_LOG_WARN,
+        (std::string("failed to cache optimized module of model '") + Name() +
+         "' at '" + cache_path + "': " + strerror(errno))
+            .c_str());
+    unlink(tmp_path.c_str());
+    return;
+  }
+
+  LOG_MESSAGE(
+      TRITONSERVER_LOG_INFO,
+      (std::string("cached optimized module of model '") + Name() + "' at '" +
+       cache_path + "'")
+          .c_str());
+}
+
+void
+ModelState::OptimizeModel(
+    const torch::Device device,
+    std::shared_ptr<torch::jit::script::Module>* torch_model)
+{
+  if (inference_optimization_ == InferenceOptimization::NONE) {
+    return;
+  }
+
+  const auto optimize_start = std::chrono::steady_clock::now();
+
+  // Freezing inlines the parameters and attributes of the module into
+  // its graph as constants, which also folds conv/batchnorm pairs.
+  // Freezing requires the module to be in evaluation mode.
+  torch::jit::Module module = **torch_model;
+  try {
+    module.eval();
+    module = torch::jit::freeze(module);
+  }
+  catch (const std::exception& ex) {
+    LOG_MESSAGE(
+        TRITONSERVER_LOG_WARN,
+        (std::string("failed to freeze model '") + Name() +
+         "', using the unoptimized model: " + ex.what())
+            .c_str());
+    return;
+  }
+
+  // optimize_for_inference additionally fuses operators and, for CPU
+  // modules, folds conv/add/mul chains, prepacks linear weights and
+  // converts eligible operators to MKLDNN.
+  std::string passes = "freeze";
+  if (inference_optimization_ ==
+      InferenceOptimization::OPTIMIZE_FOR_INFERENCE) {
+    try {
+      module = torch::jit::optimize_for_inference(module);
+      passes += ", optimize_for_inference";
+    }
+    catch (const std::exception& ex) {
+      LOG_MESSAGE(
+          TRITONSERVER_LOG_WARN,
+          (std::string("failed to run optimize_for_inference on model '") +
+           Name() + "', using the frozen model: " + ex.what())
+              .c_str());
+    }
+  }
+
+  torch_model->reset(new torch::jit::Module(module));
+
+  LOG_MESSAGE(
+      TRITONSERVER_LOG_INFO,
+      (std::string("applied ") + passes + " to model '" + Name() + "' on " +
+       device.str() + " in " +
+       std::to_string(std::chrono::duration_cast<std::chrono::milliseconds>(
+                          std::chrono::steady_clock::now() - optimize_start)
+                          .count()) +
+       " ms")
+          .c_str());
+}
+
+TRITONSERVER_Error*
+ModelState::AutoCompleteConfig()
+{
+  // Auto-complete configuration is not supported since PyTorch does not
+  // store/capture sufficient model metadata so just log error instead.
+  LOG_MESSAGE(
+      TRITONSERVER_LOG_WARN,
+      (std::string("skipping model configuration auto-complete for '") +
+       Name() + "': not supported for pytorch backend")
+          .c_str());
+
+  return nullptr;  // success
+}
+
+
+//
+// ModelInstanceState
+//
+// State associated with a model instance. An object of this class is
+// created and associated with each TRITONBACKEND_ModelInstance.
+//
+class ModelInstanceState : public BackendModelInstance {
+  /* ModelInstanceState继承BackendModelInstance类，基类中包含了诸多与某个特定model instance相关的信息，包括：*/
+  /* 指向instance对应BackendModel的指针，instance的类型(GPU/CPU)，运行设备的id，模型文件的路径等 */
+  /* 这个类的对象将依附于TRITONBACKEND_ModelInstance对象，执行实际的输入数据准备、模型前行推理和输出数据收集和发送等步骤， */
+  /* 是Backend在某个设备上的实际executor */
+ public:
+  static TRITONSERVER_Error* Create(
+      ModelState* model_state,
       TRITONBACKEND_ModelInstance* triton_model_instance,
       ModelInstanceState** state);
   virtual ~ModelInstanceState();
@@ -213,10 +1557,19 @@ class ModelInstanceState : public BackendModelInstance {
   ModelState* StateForModel() const { return model_state_; }
 
   // Execute...
+  // With asynchronous execution, or executor threads, the requests are
+  // handed to the worker pool and this returns before they are
+  // executed.
   void ProcessRequests(
       TRITONBACKEND_Request** requests, const uint32_t request_count);
 
  private:
+  // Execute 'requests' on the thread of 'worker', with its input
+  // buffers and cores, then send their responses and release them.
+  void ExecuteRequests(
+      TRITONBACKEND_Request** requests, const uint32_t request_count,
+      const size_t worker);
+
   ModelInstanceState(
       ModelState* model_state,
       TRITONBACKEND_ModelInstance* triton_model_instance);
@@ -228,24 +1581,265 @@ class ModelInstanceState : public BackendModelInstance {
       const std::string& control_kind, bool required, bool* have_control);
   TRITONSERVER_Error* ValidateInputs();
   TRITONSERVER_Error* ValidateOutputs();
+
+  // Bind each model input to a forward() argument using the schema of
+  // the loaded model and collect the argument default values.
+  TRITONSERVER_Error* BindInputs();
+
+  // Bind the forward() argument 'name', given by parameter 'param', to
+  // a tensor the backend generates and return its position in
+  // 'arg_index'.
+  TRITONSERVER_Error* BindGeneratedArgument(
+      const std::vector<c10::Argument>& arguments, const std::string& param,
+      const std::string& name, std::vector<bool>* bound, int* arg_index);
+
+  // Allocate the input buffers of a full batch up front for inputs
+  // whose shape is fully known from the model configuration.
+  void ReserveInputBuffers();
+
+  // Load the model of this instance if it is not loaded yet. The inputs
+  // of a newly loaded model are bound and the model is warmed up before
+  // returning.
+  TRITONSERVER_Error* EnsureModelLoaded();
+
+  // Run the configured number of forward calls on synthesized inputs
+  // for each warmup batch size, or each bucket, so that the profiling
+  // executor has specialized the graph before real requests arrive.
+  void Warmup();
+  // Warm up 'model' with inputs of 'batch_size' and, if positive,
+  // ragged inputs padded to 'length'.
+  void WarmupModel(
+      torch::jit::script::Module* model, const int64_t batch_size,
+      const int64_t length);
+  // Return in 'input_tensors' the forward() arguments of a batch of
+  // 'batch_size' zero-filled requests and, if positive, ragged inputs
+  // padded to 'length'.
+  void SynthesizeInputs(
+      const int64_t batch_size, const int64_t length,
+      std::vector<torch::jit::IValue>* input_tensors);
+
+  // Return an error if 'output' of classification output 'name' is not
+  // one row of classes per batch entry, or has fewer classes than the
+  // top k it returns.
+  TRITONSERVER_Error* CheckClassificationOutput(
+      const std::string& name,
+      const ModelState::Classification& classification,
+      const torch::Tensor& output) const;
+
+  // Create a module for every bucket.
+  void CreateBucketModels();
+
+  // Set the intra-op thread count, core affinity and NUMA memory node of
+  // this instance on the calling thread, the thread of 'worker', before
+  // it executes requests.
+  void ApplyThreadSettings(const size_t worker);
+  // Set the NUMA memory node of this instance on the calling pipeline
+  // thread and pin it to 'helper_cores_'. The intra-op thread count and
+  // the cores of forward() are left to the executing thread.
+  void ApplyHelperThreadSettings();
+
+  // Return the intra-op thread count to run forward() with for a batch
+  // of 'batch_size', 0 to keep the thread count set by
+  // ApplyThreadSettings().
+  int IntraOpThreadsForBatch(const int64_t batch_size) const;
+
+  // Split 'requests' into groups of similar length of their ragged
+  // inputs when padding them, so that at most the configured share of
+  // each padded batch is padding. 'groups' holds request indices and is
+  // left empty if all requests should execute together.
+  void GroupRequestsByLength(
+      TRITONBACKEND_Request** requests, const uint32_t request_count,
+      std::vector<std::vector<uint32_t>>* groups);
+
+  // Split each of 'groups' into micro-batches of consecutive requests
+  // that hold at most the model's MicroBatchSize().
+  void SplitMicroBatches(
+      const std::vector<int64_t>& request_batch_sizes,
+      std::vector<std::vector<uint32_t>>* groups);
+
+  // Requests executed by a single forward() call and the state handed
+  // from each stage of their execution to the next.
+  struct MicroBatch {
+    std::vector<TRITONBACKEND_Request*> requests;
+    std::vector<TRITONBACKEND_Response*> responses;
+    std::vector<int64_t> request_batch_sizes;
+    size_t total_batch_size;
+    // The arena and set of input buffers that hold the gathered inputs.
+    BufferArena* arena;
+    size_t buffer_set;
+
+    size_t padded_batch_size;
+    int64_t padded_length;
+    std::vector<int64_t> ragged_lengths;
+    std::vector<torch::jit::IValue> input_tensors;
+    torch::jit::script::Module* model;
+
+    std::vector<torch::Tensor> output_tensors;
+    uint64_t compute_start_ns;
+    uint64_t compute_end_ns;
+
+    CopyStats gather_stats;
+    CopyStats scatter_stats;
+    // Number of outputs that no request of the batch asked for.
+    size_t skipped_output_count;
+    // Whether a stage threw, in which case the later stages are skipped.
+    bool failed;
+  };
+
+  // Gather the inputs of 'batch' and pick the module to run them on.
+  void GatherBatch(MicroBatch* batch);
+  // Run forward() on the gathered inputs of 'batch'.
+  void ForwardBatch(MicroBatch* batch);
+  // Scatter the outputs of 'batch' into its responses.
+  void ScatterBatch(MicroBatch* batch);
+  // Fail the responses of 'batch' that are still pending with 'ex',
+  // thrown by its 'stage'.
+  void FailBatch(
+      MicroBatch* batch, const std::string& stage, const std::exception& ex);
+
+  // Execute 'batches' with their gathering, forward() and scattering
+  // overlapped on the pipeline threads, sending the responses of each
+  // batch as soon as it is scattered.
+  void RunPipeline(
+      std::vector<MicroBatch>* batches, const uint64_t exec_start_ns);
+
+  // Send the 'responses' that haven't failed, report the statistics of
+  // 'requests' and release them.
+  void CompleteRequests(
+      TRITONBACKEND_Request** requests, const uint32_t request_count,
+      std::vector<TRITONBACKEND_Response*>* responses,
+      const uint64_t exec_start_ns, const uint64_t compute_start_ns,
+      const uint64_t compute_end_ns, const uint64_t exec_end_ns);
+
   void Execute(
+      torch::jit::Module* model,
       std::vector<TRITONBACKEND_Response*>* responses,
-      const uint32_t response_count,
+      const uint32_t response_count, const size_t batch_size,
       std::vector<torch::jit::IValue>* input_tensors,
       std::vector<torch::Tensor>* output_tensors);
   void SetInputTensors(
-      size_t total_batch_size, TRITONBACKEND_Request** requests,
+      size_t total_batch_size, const size_t padded_batch_size,
+      BufferArena* arena, const size_t buffer_set,
+      TRITONBACKEND_Request** requests,
       const uint32_t request_count,
       std::vector<TRITONBACKEND_Response*>* responses,
-      BackendInputCollector* collector, std::vector<const char*>* input_names,
+      BackendInputCollector* collector,
       std::vector<torch::jit::IValue>* input_tensors,
-      std::vector<BackendMemory*>* input_memories, bool* cuda_copy);
+      std::vector<int64_t>* ragged_lengths, int64_t* padded_length,
+      CopyStats* gather_stats, bool* cuda_copy);
+
+  // Copy ragged input 'input_name' of each request 'r' into row 'r' of
+  // the host memory 'buffer', zero-filling the row beyond the request's
+  // length up to 'max_length'. Rows from 'request_count' up to
+  // 'row_count' are zero-filled.
+  TRITONSERVER_Error* GatherPaddedInput(
+      const char* input_name, TRITONBACKEND_Request** requests,
+      const uint32_t request_count, const std::vector<int64_t>& lengths,
+      const int64_t max_length, const size_t row_count,
+      const size_t row_byte_size, char* buffer, CopyStats* stats);
+
+  // Return in 'batchn_shape' the shape of ragged input 'input_name'
+  // concatenated over all requests and in 'lengths' the length of each
+  // request in the concatenated dimension.
+  TRITONSERVER_Error* RaggedInputShape(
+      const char* input_name, TRITONBACKEND_Request** requests,
+      const uint32_t request_count, std::vector<int64_t>* batchn_shape,
+      std::vector<int64_t>* lengths);
+
+  // Copy 'input_name' of all requests into the host memory 'buffer' of
+  // 'byte_size' bytes with the copy engine. Return false, without
+  // copying, if any request input is not in host memory or doesn't
+  // match 'byte_size', leaving the batch to the input collector.
+  bool GatherInput(
+      const char* input_name, TRITONBACKEND_Request** requests,
+      const uint32_t request_count, char* buffer, const size_t byte_size,
+      CopyStats* stats);
+  // Gather 'input_name' of all requests, sent as 'datatype', into a
+  // buffer of 'arena_slot' and return it in 'tensor' as a tensor of
+  // 'padded_shape' converted by 'conversion', each request's values
+  // converted by the copy that gathers them and the rows beyond
+  // 'element_count' values zeroed. Leave 'tensor' undefined, without
+  // copying, if any request input is not in host memory or the inputs
+  // don't hold 'element_count' values, leaving the batch to the input
+  // collector.
+  TRITONSERVER_Error* GatherConvertedInput(
+      const char* input_name,
+      const ModelState::IngressConversion& conversion,
+      const TRITONSERVER_DataType datatype, TRITONBACKEND_Request** requests,
+      const uint32_t request_count, const std::vector<int64_t>& padded_shape,
+      const int64_t element_count, BufferArena* arena,
+      const size_t arena_slot, torch::Tensor* tensor, CopyStats* stats);
+  // Write 'src' into 'dst', a tensor of the same shape, converted by
+  // 'conversion'. The datatype conversion, scale and offset are a single
+  // libtorch op so that the values are only read and written once.
+  static void ConvertIngress(
+      const ModelState::IngressConversion& conversion,
+      const torch::Tensor& src, torch::Tensor* dst);
+  // Return the buffer of 'input' if it can be used as the input tensor
+  // of a single-request batch without a copy, nullptr otherwise.
+  char* DirectInputBuffer(
+      TRITONBACKEND_Input* input, const TRITONSERVER_DataType datatype,
+      const int64_t byte_size);
   void ReadOutputTensors(
-      size_t total_batch_size, const std::vector<const char*>& output_names,
+      size_t total_batch_size, const size_t padded_batch_size,
+      const int64_t padded_length,
       const std::vector<torch::Tensor>& output_tensors,
       TRITONBACKEND_Request** requests, const uint32_t request_count,
+      const std::vector<int64_t>& request_batch_sizes,
+      const std::vector<int64_t>& ragged_lengths,
+      std::vector<TRITONBACKEND_Response*>* responses,
+      CopyStats* scatter_stats, size_t* skipped_output_count);
+
+  // Send each request 'r' whose 'requested[r]' is set the top-K
+  // classes of 'classification' of each of its rows of output 'name',
+  // 'output', as "<score>:<index>[:<label>]" strings.
+  void ScatterClassification(
+      const std::string& name,
+      const ModelState::Classification& classification,
+      const torch::Tensor& output, const std::vector<bool>& requested,
+      const uint32_t request_count,
+      const std::vector<int64_t>& request_batch_sizes,
       std::vector<TRITONBACKEND_Response*>* responses);
 
+  // The copy of a request's slice of a host output that is not
+  // contiguous into the response buffer 'dst'.
+  struct StridedCopy {
+    uint32_t request;
+    torch::Tensor dst;
+    torch::Tensor src;
+    // If positive, 'src' is quantized to INT8 with this scale on the
+    // way, see QuantizeInt8().
+    double quantize_scale;
+  };
+
+  // Return 'src' divided by 'scale', rounded and saturated to the INT8
+  // range, still in the datatype of 'src'. Only the division allocates,
+  // rounding and saturating are done in place.
+  static torch::Tensor QuantizeInt8(
+      const torch::Tensor& src, const double scale);
+
+  // Create output 'name' with shape 'request_shapes[i]' in the response
+  // of every request 'i' whose 'requested[i]' is set and append the
+  // copy of its
+  // slice of the host memory 'buffer' to 'spans'. The slice of request
+  // 'i' starts at 'i * request_byte_stride', or right after the slice
+  // of the previous request if 'request_byte_stride' is 0. If
+  // 'request_slices' is not nullptr the slice of request 'i' is instead
+  // the strided tensor 'request_slices[i]', undefined if the output has
+  // no such slice, and its copy is appended to 'strided_copies',
+  // quantized to INT8 with 'quantize_scale' if positive.
+  void ScatterOutput(
+      const std::string& name, const TRITONSERVER_DataType dtype,
+      const std::vector<std::vector<int64_t>>& request_shapes,
+      const char* buffer, const size_t buffer_byte_size,
+      const size_t request_byte_stride,
+      const std::vector<torch::Tensor>* request_slices,
+      const double quantize_scale, const std::vector<bool>& requested,
+      const uint32_t request_count,
+      std::vector<TRITONBACKEND_Response*>* responses,
+      std::vector<CopySpan>* spans,
+      std::vector<StridedCopy>* strided_copies, bool* cuda_copy);
+
   ModelState* model_state_;
 
   // The full path to the TorchScript model file.
@@ -254,14 +1848,136 @@ class ModelInstanceState : public BackendModelInstance {
   std::unique_ptr<torch::jit::script::Module> torch_model_;
   torch::Device device_;
 
-  // Map from configuration name for an input to the index of
-  // that input in the model.
-  std::unordered_map<std::string, int> input_index_map_;
-
-  // Map from configuration name for an output to the index of
-  // that output in the model.
-  std::unordered_map<std::string, int> output_index_map_;
-  std::unordered_map<std::string, TRITONSERVER_DataType> output_dtype_map_;
+  // Clones of 'torch_model_' sharing its weights, one per combination
+  // of batch bucket and sequence bucket (0 if that size isn't
+  // bucketed), so that each keeps the graph specialized for its shape.
+  // Empty if no buckets are configured.
+  std::map<
+      std::pair<int64_t, int64_t>,
+      std::unique_ptr<torch::jit::script::Module>>
+      bucket_models_;
+  // The buckets in effect for this instance.
+  std::vector<int64_t> batch_buckets_;
+  std::vector<int64_t> sequence_buckets_;
+
+  // The binding of model inputs and outputs to the forward() call is
+  // resolved once, when the instance is created for outputs and when
+  // the model is loaded for inputs, so that executing a batch needs no
+  // configuration or map lookups.
+  //
+  // Every model input, including sequence control inputs, with its
+  // datatype, its shape without the batch dimension, whether requests
+  // may omit it or may differ in its first non-batch dimension, the
+  // index given by the <name>__<index> naming convention (-1 if not
+  // used), its position in the forward() arguments and, if requests
+  // send it in another datatype than 'dtype', its conversion.
+  struct InputBinding {
+    std::string name;
+    torch::ScalarType dtype;
+    std::vector<int64_t> dims;
+    bool optional;
+    bool ragged;
+    int name_index;
+    int arg_index;
+    const ModelState::IngressConversion* ingress;
+  };
+  std::vector<InputBinding> input_bindings_;
+
+  // Number of forward() arguments and their default values. Arguments
+  // without a default hold a None value.
+  size_t forward_arg_count_;
+  std::vector<torch::jit::IValue> default_args_;
+
+  // If true some inputs are ragged. Each ragged input is passed as the
+  // concatenation of the request tensors along their first non-batch
+  // dimension, and the argument at 'ragged_offsets_arg_index_' gets
+  // the offset of every request in that dimension. When the model's
+  // RaggedBatchingMode() is PAD each request is instead padded to the
+  // longest request of the batch.
+  bool ragged_batching_;
+  int ragged_offsets_arg_index_;
+
+  // When padding ragged inputs, the argument at 'padding_mask_arg_index_'
+  // gets a BOOL mask of the valid positions of each request, -1 if the
+  // model takes no mask.
+  int padding_mask_arg_index_;
+
+  // Batch buffers of the inputs, one slot per entry of
+  // 'input_bindings_' in each of the sets of buffers, reused across
+  // executions. There is a single set unless micro-batches are
+  // pipelined, in which case each micro-batch in flight uses its own
+  // set. Executions on the model's worker pool use the arena of their
+  // worker, synchronous executions use the only arena.
+  std::vector<std::unique_ptr<BufferArena>> input_arenas_;
+
+  // The model's worker pool if requests are executed asynchronously, or
+  // the executor threads of this instance, and the number of
+  // executions handed to it that haven't completed.
+  WorkStealingPool* worker_pool_;
+  std::unique_ptr<WorkStealingPool> executor_pool_;
+  std::mutex async_mu_;
+  std::condition_variable async_cv_;
+  size_t async_pending_;
+
+  // The two threads that gather and scatter pipelined micro-batches
+  // while the executing thread runs forward(), nullptr if micro-batches
+  // are not pipelined.
+  std::unique_ptr<ThreadPool> pipeline_pool_;
+  // Pipelined micro-batches in flight at once: one being gathered, one
+  // running forward() and one being scattered.
+  static constexpr size_t kPipelineBufferSets = 3;
+
+  // Number of intra-op threads forward() runs with, 0 for the libtorch
+  // default, and the cores that the threads running forward() are
+  // pinned to, empty if not pinned. The cores are released to the
+  // backend's budget if reserved from it.
+  int intra_op_thread_count_;
+  std::vector<int> cores_;
+  bool cores_reserved_;
+  // The cores of 'cores_' that each worker is pinned to, by worker
+  // index. Executor threads each get their own intra-op thread count
+  // of reserved cores, other workers share all of them.
+  std::vector<std::vector<int>> worker_cores_;
+
+  // Intra-op thread count of forward() by batch size, configured or
+  // learned during warmup. See ModelState::IntraOpThreadsByBatch().
+  ModelState::ThreadsByBatch threads_by_batch_;
+
+  // The NUMA node whose memory holds the weights and buffers of this
+  // instance, -1 if not placed on a node.
+  int numa_node_;
+  // The CPUs the pipeline threads are pinned to: those of the NUMA node
+  // that are not reserved for forward(), or all of them if every CPU of
+  // the node is reserved. Empty if not placed on a node.
+  std::vector<int> helper_cores_;
+
+  // Host copies of gathered inputs and scattered outputs, and their
+  // totals over the lifetime of the instance.
+  CopyEngine copy_engine_;
+  std::mutex stats_mu_;
+  CopyStats gather_stats_;
+  CopyStats scatter_stats_;
+  uint64_t skipped_output_count_;
+  // The counter of skipped outputs of this instance, nullptr if metrics
+  // are not available.
+  TRITONSERVER_Metric* skipped_outputs_metric_;
+
+  // Every model output with its datatype, its shape without the batch
+  // dimension, its position in the forward() result and, if it returns
+  // the top-K classes of the result, its classification. 'egress_scale'
+  // is positive if the result is converted to 'dtype'.
+  struct OutputBinding {
+    std::string name;
+    TRITONSERVER_DataType dtype;
+    std::vector<int64_t> dims;
+    int output_index;
+    const ModelState::Classification* classification;
+    double egress_scale;
+  };
+  std::vector<OutputBinding> output_bindings_;
+
+  // Largest 'output_index' of any output.
+  int max_output_index_;
 };
 
 TRITONSERVER_Error*
@@ -285,16 +2001,19 @@ ModelInstanceState::Create(
 ModelInstanceState::ModelInstanceState(
     ModelState* model_state, TRITONBACKEND_ModelInstance* triton_model_instance)
     : BackendModelInstance(model_state, triton_model_instance),
-      model_state_(model_state), device_(torch::kCPU)
+      model_state_(model_state), device_(torch::kCPU), forward_arg_count_(0),
+      ragged_batching_(false), ragged_offsets_arg_index_(-1),
+      padding_mask_arg_index_(-1), worker_pool_(nullptr), async_pending_(0),
+      intra_op_thread_count_(model_state->IntraOpThreadCount()),
+      cores_reserved_(false),
+      threads_by_batch_(model_state->IntraOpThreadsByBatch()), numa_node_(-1),
+      copy_engine_(model_state->CopyPool()), skipped_output_count_(0),
+      skipped_outputs_metric_(nullptr), max_output_index_(-1)
 {
   if (Kind() == TRITONSERVER_INSTANCEGROUPKIND_GPU) {
     device_ = torch::Device(torch::kCUDA, DeviceId());
   }
 
-  /* 根据模型config携带的模型文件名，去读取PyTorch模型 */
-  THROW_IF_BACKEND_INSTANCE_ERROR(model_state->LoadModel(
-      ArtifactFilename(), device_, &model_path_, &torch_model_));
-  
   /* 从模型config中获取输入的数量 */
   size_t expected_input_cnt = 0;
   {
@@ -339,51 +2058,672 @@ ModelInstanceState::ModelInstanceState(
 
   THROW_IF_BACKEND_INSTANCE_ERROR(ValidateInputs());
   THROW_IF_BACKEND_INSTANCE_ERROR(ValidateOutputs());
-}
 
-ModelInstanceState::~ModelInstanceState()
-{
-  torch_model_.reset();
-#ifdef TRITON_ENABLE_GPU
-  if (device_.is_cuda()) {
-    c10::cuda::CUDACachingAllocator::emptyCache();
+  // Buffers held across executions use plain device memory rather than
+  // the CUDA memory pool, which is shared and meant for short-lived
+  // allocations.
+  std::vector<BackendMemory::AllocationType> alloc_types;
+  if (device_.is_cpu()) {
+    alloc_types = {BackendMemory::AllocationType::CPU};
+  } else {
+    alloc_types = {BackendMemory::AllocationType::GPU};
   }
-#endif  // TRITON_ENABLE_GPU
-}
-
-TRITONSERVER_Error*
-ModelInstanceState::ValidateBooleanSequenceControl(
-    triton::common::TritonJson::Value& sequence_batching,
-    const std::string& control_kind, bool required, bool* have_control)
-{
-  std::string tensor_name;
-  std::string tensor_datatype;
-  RETURN_IF_ERROR(GetBooleanSequenceControlProperties(
-      sequence_batching, model_state_->Name(), control_kind, required,
-      &tensor_name, &tensor_datatype, nullptr, nullptr, nullptr, nullptr));
-  *have_control = !tensor_name.empty();
-  if (*have_control) {
-    std::string deliminator = "__";
-    int ip_index = 0;
-    try {
-      int start_pos = tensor_name.find(deliminator);
-      if (start_pos == -1) {
-        throw std::invalid_argument("input must follow naming convention");
-      }
-      ip_index = std::atoi(tensor_name.substr(start_pos + 2).c_str());
-      input_index_map_[tensor_name] = ip_index;
+  // Micro-batches overlap copies with compute on the host only.
+  size_t buffer_set_count = 1;
+  if (model_state->MicroBatchSize() > 0) {
+    if (device_.is_cpu()) {
+      pipeline_pool_.reset(new ThreadPool(2));
+      buffer_set_count = kPipelineBufferSets;
+    } else {
+      LOG_MESSAGE(
+          TRITONSERVER_LOG_WARN,
+          (std::string("MICRO_BATCH_SIZE only applies to CPU instances, "
+                       "ignoring it for '") +
+           Name() + "'")
+              .c_str());
     }
-    catch (std::exception& ex) {
-      return TRITONSERVER_ErrorNew(
-          TRITONSERVER_ERROR_INTERNAL,
-          ("input '" + tensor_name +
-           "' does not follow naming convention i.e. <name>__<index>.")
+  }
+  // Asynchronous executions run concurrently on the worker pool, each
+  // with the buffers of its worker. Executor threads of the instance
+  // likewise run forward() concurrently on its single module.
+  size_t arena_count = 1;
+  if (model_state->ExecutorThreadCount() > 1) {
+    if (device_.is_cpu()) {
+      executor_pool_.reset(
+          new WorkStealingPool(model_state->ExecutorThreadCount()));
+      worker_pool_ = executor_pool_.get();
+      arena_count = executor_pool_->Size();
+    } else {
+      LOG_MESSAGE(
+          TRITONSERVER_LOG_WARN,
+          (std::string("EXECUTOR_THREAD_COUNT only applies to CPU "
+                       "instances, '") +
+           Name() + "' executes on a single thread")
+              .c_str());
+    }
+  } else if (model_state->WorkerPool() != nullptr) {
+    if (device_.is_cpu()) {
+      worker_pool_ = model_state->WorkerPool();
+      arena_count = worker_pool_->Size();
+    } else {
+      LOG_MESSAGE(
+          TRITONSERVER_LOG_WARN,
+          (std::string("ASYNC_EXECUTION only applies to CPU instances, '") +
+           Name() + "' executes synchronously")
               .c_str());
     }
   }
+  // A CPU instance placed on a NUMA node keeps its memory, and its
+  // threads, on that node.
+  std::vector<int> node_cpus;
+  if (device_.is_cpu()) {
+    const NumaNode* node = model_state->NextNumaNode();
+    if (node != nullptr) {
+      numa_node_ = node->id;
+      node_cpus = node->cpus;
+    }
+  }
 
-  return nullptr;  // success
-}
+  // The input buffers are bound to the NUMA node of the instance, as the
+  // pipeline and copy threads that first touch them may run elsewhere.
+  for (size_t i = 0; i < arena_count; ++i) {
+    input_arenas_.emplace_back(new BufferArena(
+        model_state->TritonMemoryManager(), alloc_types,
+        device_.is_cpu() ? 0 : device_.index(),
+        input_bindings_.size() * buffer_set_count,
+        model_state->InputBufferShrinkInterval(), numa_node_));
+  }
+
+  // Instances on CPU with their own intra-op thread count are pinned to
+  // as many cores of the backend's budget per executor thread, on their
+  // NUMA node if any. Otherwise an instance on a NUMA node is pinned to
+  // all CPUs of the node. Workers of the asynchronous pool run several
+  // instances, so their threads are not pinned.
+  if (device_.is_cpu() &&
+      ((worker_pool_ == nullptr) || (executor_pool_ != nullptr))) {
+    const size_t core_count =
+        intra_op_thread_count_ *
+        ((executor_pool_ != nullptr) ? executor_pool_->Size() : 1);
+    if ((intra_op_thread_count_ > 0) && model_state->HasCoreBudget()) {
+      cores_reserved_ =
+          model_state->ReserveCores(core_count, node_cpus, &cores_);
+      if (!cores_reserved_) {
+        LOG_MESSAGE(
+            TRITONSERVER_LOG_WARN,
+            (std::string("CPU core budget has fewer than ") +
+             std::to_string(core_count) + " free cores" +
+             (node_cpus.empty()
+                  ? std::string()
+                  : " on NUMA node " + std::to_string(numa_node_)) +
+             ", '" + Name() + "' is not pinned to its own cores")
+                .c_str());
+      }
+    }
+    if (cores_.empty()) {
+      cores_ = node_cpus;
+    }
+  }
+  for (const int cpu : node_cpus) {
+    if (!cores_reserved_ ||
+        (std::find(cores_.begin(), cores_.end(), cpu) == cores_.end())) {
+      helper_cores_.push_back(cpu);
+    }
+  }
+  if (helper_cores_.empty()) {
+    helper_cores_ = node_cpus;
+  }
+  for (size_t worker = 0; worker < input_arenas_.size(); ++worker) {
+    if (cores_reserved_ && (executor_pool_ != nullptr)) {
+      const auto begin = cores_.begin() + worker * intra_op_thread_count_;
+      worker_cores_.emplace_back(begin, begin + intra_op_thread_count_);
+    } else {
+      worker_cores_.push_back(cores_);
+    }
+  }
+  if ((intra_op_thread_count_ > 0) || (numa_node_ >= 0) ||
+      (executor_pool_ != nullptr)) {
+    std::string cores_str;
+    for (const int core : cores_) {
+      cores_str += (cores_str.empty() ? "" : ",") + std::to_string(core);
+    }
+    LOG_MESSAGE(
+        TRITONSERVER_LOG_INFO,
+        (std::string("'") + Name() + "' runs forward() with " +
+         ((intra_op_thread_count_ > 0)
+              ? std::to_string(intra_op_thread_count_)
+              : std::string("the default number of")) +
+         " intra-op threads" +
+         ((executor_pool_ != nullptr)
+              ? " on each of " + std::to_string(executor_pool_->Size()) +
+                    " executor threads"
+              : std::string()) +
+         ((numa_node_ >= 0)
+              ? " on NUMA node " + std::to_string(numa_node_)
+              : std::string()) +
+         (cores_.empty() ? std::string()
+                         : " pinned to cores " + cores_str) +
+         ((cores_reserved_ && (executor_pool_ != nullptr))
+              ? ", each executor thread to " +
+                    std::to_string(intra_op_thread_count_) + " of them"
+              : std::string()))
+            .c_str());
+  }
+
+  if (model_state->SkippedOutputsFamily() != nullptr) {
+    const std::string version = std::to_string(model_state->Version());
+    std::vector<const TRITONSERVER_Parameter*> labels = {
+        TRITONSERVER_ParameterNew(
+            "model", TRITONSERVER_PARAMETER_STRING,
+            model_state->Name().c_str()),
+        TRITONSERVER_ParameterNew(
+            "version", TRITONSERVER_PARAMETER_STRING, version.c_str()),
+        TRITONSERVER_ParameterNew(
+            "instance", TRITONSERVER_PARAMETER_STRING, Name().c_str())};
+    TRITONSERVER_Error* err = TRITONSERVER_MetricNew(
+        &skipped_outputs_metric_, model_state->SkippedOutputsFamily(),
+        labels.data(), labels.size());
+    for (const auto label : labels) {
+      TRITONSERVER_ParameterDelete(
+          const_cast<TRITONSERVER_Parameter*>(label));
+    }
+    if (err != nullptr) {
+      LOG_IF_ERROR(err, "failed to create skipped output metric");
+      skipped_outputs_metric_ = nullptr;
+    }
+  }
+
+  /* 根据模型config携带的模型文件名，去读取PyTorch模型 */
+  // Lazy instances load the model when the first requests arrive.
+  if (!model_state->LazyInstanceLoading()) {
+    TRITONSERVER_Error* err = EnsureModelLoaded();
+    if (err != nullptr) {
+      // The destructor doesn't run when the constructor throws, give the
+      // reserved cores back to the budget and drop the metric here.
+      if (cores_reserved_) {
+        model_state_->ReleaseCores(cores_);
+        cores_reserved_ = false;
+      }
+      if (skipped_outputs_metric_ != nullptr) {
+        LOG_IF_ERROR(
+            TRITONSERVER_MetricDelete(skipped_outputs_metric_),
+            "failed to delete skipped output metric");
+      }
+      throw BackendModelInstanceException(err);
+    }
+  }
+}
+
+ModelInstanceState::~ModelInstanceState()
+{
+  // Executions still on the worker pool refer to this instance.
+  {
+    std::unique_lock<std::mutex> lk(async_mu_);
+    async_cv_.wait(lk, [this] { return async_pending_ == 0; });
+  }
+  if (cores_reserved_) {
+    model_state_->ReleaseCores(cores_);
+  }
+  if (skipped_outputs_metric_ != nullptr) {
+    LOG_IF_ERROR(
+        TRITONSERVER_MetricDelete(skipped_outputs_metric_),
+        "failed to delete skipped output metric");
+  }
+
+  LOG_MESSAGE(
+      TRITONSERVER_LOG_INFO,
+      (std::string("instance '") + Name() + "' gathered " +
+       std::to_string(gather_stats_.bytes) + " input bytes in " +
+       std::to_string(gather_stats_.copy_ns / 1000) + " us and scattered " +
+       std::to_string(scatter_stats_.bytes) + " output bytes in " +
+       std::to_string(scatter_stats_.copy_ns / 1000) + " us, skipping " +
+       std::to_string(skipped_output_count_) + " unrequested outputs")
+          .c_str());
+
+  torch_model_.reset();
+#ifdef TRITON_ENABLE_GPU
+  if (device_.is_cuda()) {
+    c10::cuda::CUDACachingAllocator::emptyCache();
+  }
+#endif  // TRITON_ENABLE_GPU
+}
+
+TRITONSERVER_Error*
+ModelInstanceState::EnsureModelLoaded()
+{
+  if (torch_model_ == nullptr) {
+    // The weights and preallocated buffers come from the memory of the
+    // instance's NUMA node.
+    ScopedThreadMemoryNode memory_node(numa_node_);
+    RETURN_IF_ERROR(model_state_->LoadModel(
+        ArtifactFilename(), device_, numa_node_, &model_path_,
+        &torch_model_));
+    TRITONSERVER_Error* err = BindInputs();
+    if (err != nullptr) {
+      torch_model_.reset();
+      return err;
+    }
+    ReserveInputBuffers();
+    CreateBucketModels();
+    Warmup();
+  }
+
+  return nullptr;  // success
+}
+
+void
+ModelInstanceState::ApplyThreadSettings(const size_t worker)
+{
+  if ((intra_op_thread_count_ > 0) &&
+      (at::get_num_threads() != intra_op_thread_count_)) {
+    at::set_num_threads(intra_op_thread_count_);
+  }
+
+  // A thread normally runs forward() of a single instance, so the
+  // affinity is only set the first time.
+  const std::vector<int>& cores = worker_cores_[worker];
+  thread_local std::vector<int> thread_cores;
+  if (!cores.empty() && (thread_cores != cores)) {
+    TRITONSERVER_Error* err = SetThreadAffinity(cores);
+    if (err != nullptr) {
+      LOG_MESSAGE(
+          TRITONSERVER_LOG_WARN,
+          (std::string("failed to pin '") + Name() +
+           "': " + TRITONSERVER_ErrorMessage(err))
+              .c_str());
+      TRITONSERVER_ErrorDelete(err);
+    }
+    thread_cores = cores;
+  }
+
+  // Other instances, or the loading of a model, may have changed the
+  // memory node of the thread so it is always set.
+  if (numa_node_ >= 0) {
+    LOG_IF_ERROR(
+        SetThreadMemoryNode(numa_node_),
+        ("failed to prefer memory of NUMA node " + std::to_string(numa_node_))
+            .c_str());
+  }
+}
+
+void
+ModelInstanceState::ApplyHelperThreadSettings()
+{
+  // The pipeline threads only run this instance, so they are pinned
+  // once.
+  thread_local bool pinned = false;
+  if (!pinned && !helper_cores_.empty()) {
+    LOG_IF_ERROR(
+        SetThreadAffinity(helper_cores_),
+        ("failed to pin pipeline thread of '" + Name() + "'").c_str());
+    pinned = true;
+  }
+  if (numa_node_ >= 0) {
+    LOG_IF_ERROR(
+        SetThreadMemoryNode(numa_node_),
+        ("failed to prefer memory of NUMA node " + std::to_string(numa_node_))
+            .c_str());
+  }
+}
+
+void
+ModelInstanceState::CreateBucketModels()
+{
+  bucket_models_.clear();
+
+  // Concatenated ragged inputs have no batch dimension to pad.
+  std::vector<int64_t> batch_buckets = model_state_->BatchBuckets();
+  if (!batch_buckets.empty() && (ragged_offsets_arg_index_ >= 0)) {
+    LOG_MESSAGE(
+        TRITONSERVER_LOG_WARN,
+        (std::string("BATCH_BUCKETS don't apply to concatenated ragged "
+                     "inputs, ignoring them for '") +
+         Name() + "'")
+            .c_str());
+    batch_buckets.clear();
+  }
+  std::vector<int64_t> sequence_buckets = model_state_->SequenceBuckets();
+  batch_buckets_ = batch_buckets;
+  sequence_buckets_ = sequence_buckets;
+  if (batch_buckets.empty() && sequence_buckets.empty()) {
+    return;
+  }
+  if (batch_buckets.empty()) {
+    batch_buckets.push_back(0);
+  }
+  if (sequence_buckets.empty()) {
+    sequence_buckets.push_back(0);
+  }
+
+  for (const int64_t batch_bucket : batch_buckets) {
+    for (const int64_t sequence_bucket : sequence_buckets) {
+      bucket_models_[std::make_pair(batch_bucket, sequence_bucket)].reset(
+          new torch::jit::script::Module(torch_model_->clone(true)));
+    }
+  }
+}
+
+void
+ModelInstanceState::ReserveInputBuffers()
+{
+  const int max_batch_size = model_state_->MaxBatchSize();
+  for (size_t i = 0; i < input_bindings_.size(); ++i) {
+    const auto& binding = input_bindings_[i];
+    int64_t byte_size = c10::elementSize(binding.dtype);
+    if (max_batch_size > 0) {
+      byte_size *= max_batch_size;
+    }
+    for (const int64_t dim : binding.dims) {
+      byte_size *= dim;
+    }
+    // A variable-size dimension makes the product negative.
+    if (byte_size <= 0) {
+      continue;
+    }
+
+    for (auto& arena : input_arenas_) {
+      TRITONSERVER_Error* err = arena->Reserve(i, byte_size);
+      if (err != nullptr) {
+        LOG_MESSAGE(
+            TRITONSERVER_LOG_WARN,
+            (std::string("failed to reserve input buffer for '") +
+             binding.name + "' of '" + Name() +
+             "': " + TRITONSERVER_ErrorMessage(err))
+                .c_str());
+        TRITONSERVER_ErrorDelete(err);
+      }
+    }
+  }
+}
+
+void
+ModelInstanceState::Warmup()
+{
+  const int iterations = model_state_->WarmupIterations();
+  if (iterations <= 0) {
+    return;
+  }
+
+  // A batch size of 0 stands for a model that doesn't support
+  // batching and so has no batch dimension.
+  const int max_batch_size = model_state_->MaxBatchSize();
+  std::vector<int64_t> batch_sizes = model_state_->WarmupBatchSizes();
+  if (max_batch_size == 0) {
+    batch_sizes = {0};
+  } else if (batch_sizes.empty()) {
+    batch_sizes.push_back(1);
+    if (max_batch_size > 1) {
+      batch_sizes.push_back(max_batch_size);
+    }
+  }
+
+  // The latencies, and the thread counts learned from them, are those
+  // of forward() on the cores and with the intra-op thread count the
+  // instance executes with. The caller already prefers the memory of
+  // the instance's NUMA node.
+  ScopedThreadAffinity affinity(worker_cores_[0]);
+  ScopedIntraOpThreads intra_op_threads(intra_op_thread_count_);
+
+  // With buckets every bucket module is warmed up with the shape it
+  // serves, its batch bucket replacing the warmup batch sizes.
+  if (!bucket_models_.empty()) {
+    for (const auto& pr : bucket_models_) {
+      const int64_t batch_bucket = pr.first.first;
+      const int64_t sequence_bucket = pr.first.second;
+      const std::vector<int64_t> bucket_batch_sizes =
+          (batch_bucket > 0) ? std::vector<int64_t>{batch_bucket}
+                             : batch_sizes;
+      for (const int64_t batch_size : bucket_batch_sizes) {
+        WarmupModel(pr.second.get(), batch_size, sequence_bucket);
+      }
+    }
+  } else {
+    for (const int64_t batch_size : batch_sizes) {
+      if ((max_batch_size > 0) &&
+          ((batch_size < 1) || (batch_size > max_batch_size))) {
+        LOG_MESSAGE(
+            TRITONSERVER_LOG_WARN,
+            (std::string("skipping warmup batch size ") +
+             std::to_string(batch_size) + " for '" + Name() +
+             "', max allowed is " + std::to_string(max_batch_size))
+                .c_str());
+        continue;
+      }
+      WarmupModel(torch_model_.get(), batch_size, 0 /* length */);
+    }
+  }
+
+  // A batch size warmed up more than once, e.g. by several buckets,
+  // keeps the thread count learned first.
+  std::stable_sort(
+      threads_by_batch_.begin(), threads_by_batch_.end(),
+      [](const std::pair<int64_t, int>& a, const std::pair<int64_t, int>& b) {
+        return a.first < b.first;
+      });
+  threads_by_batch_.erase(
+      std::unique(
+          threads_by_batch_.begin(), threads_by_batch_.end(),
+          [](const std::pair<int64_t, int>& a,
+             const std::pair<int64_t, int>& b) { return a.first == b.first; }),
+      threads_by_batch_.end());
+}
+
+
+void
+ModelInstanceState::SynthesizeInputs(
+    const int64_t batch_size, const int64_t length,
+    std::vector<torch::jit::IValue>* input_tensors)
+{
+  const int max_batch_size = model_state_->MaxBatchSize();
+
+  // Variable-size dimensions have size 1.
+  *input_tensors = default_args_;
+  int64_t ragged_length = 1;
+  for (const auto& binding : input_bindings_) {
+    std::vector<int64_t> shape;
+    if (max_batch_size > 0) {
+      shape.push_back(batch_size);
+    }
+    for (const int64_t dim : binding.dims) {
+      shape.push_back((dim < 0) ? 1 : dim);
+    }
+    // A concatenated ragged input holds 'batch_size' requests.
+    if (binding.ragged && (shape.size() > 1)) {
+      if (length > 0) {
+        shape[1] = length;
+      }
+      ragged_length = shape[1];
+      if (ragged_offsets_arg_index_ >= 0) {
+        shape[1] *= shape[0];
+        shape.erase(shape.begin());
+      }
+    }
+    (*input_tensors)[binding.arg_index] = torch::zeros(
+        shape, torch::TensorOptions(binding.dtype).device(device_));
+  }
+  if (padding_mask_arg_index_ >= 0) {
+    (*input_tensors)[padding_mask_arg_index_] = torch::ones(
+        {batch_size, ragged_length},
+        torch::TensorOptions(torch::kBool).device(device_));
+  }
+  if (ragged_offsets_arg_index_ >= 0) {
+    std::vector<int64_t> offsets;
+    for (int64_t i = 0; i <= batch_size; ++i) {
+      offsets.push_back(i * ragged_length);
+    }
+    (*input_tensors)[ragged_offsets_arg_index_] =
+        torch::tensor(offsets, torch::TensorOptions(torch::kInt64))
+            .to(device_);
+  }
+}
+
+TRITONSERVER_Error*
+ModelInstanceState::CheckClassificationOutput(
+    const std::string& name, const ModelState::Classification& classification,
+    const torch::Tensor& output) const
+{
+  const int64_t dim_count = (model_state_->MaxBatchSize() > 0) ? 2 : 1;
+  if (output.dim() != dim_count) {
+    return TRITONSERVER_ErrorNew(
+        TRITONSERVER_ERROR_INVALID_ARG,
+        ("classification output '" + name + "' for model '" +
+         model_state_->Name() + "' must be " +
+         ((dim_count == 2) ? "[batch, classes]" : "[classes]") +
+         " but forward() returns " + std::to_string(output.dim()) +
+         " dimensions")
+            .c_str());
+  }
+  if (output.size(-1) < classification.k) {
+    return TRITONSERVER_ErrorNew(
+        TRITONSERVER_ERROR_INVALID_ARG,
+        ("classification output '" + name + "' for model '" +
+         model_state_->Name() + "' returns the top " +
+         std::to_string(classification.k) + " classes but forward() has " +
+         std::to_string(output.size(-1)))
+            .c_str());
+  }
+
+  return nullptr;  // success
+}
+
+int
+ModelInstanceState::IntraOpThreadsForBatch(const int64_t batch_size) const
+{
+  if (threads_by_batch_.empty()) {
+    return 0;
+  }
+  for (const auto& pr : threads_by_batch_) {
+    if (batch_size <= pr.first) {
+      return pr.second;
+    }
+  }
+  return threads_by_batch_.back().second;
+}
+
+void
+ModelInstanceState::WarmupModel(
+    torch::jit::script::Module* model, const int64_t batch_size,
+    const int64_t length)
+{
+  const int iterations = model_state_->WarmupIterations();
+  std::vector<torch::jit::IValue> input_tensors;
+  SynthesizeInputs(batch_size, length, &input_tensors);
+
+  const std::string shape_str =
+      "batch size " + std::to_string(batch_size) +
+      ((length > 0) ? " and length " + std::to_string(length) : "");
+
+  // Run the iterations with 'thread_count' intra-op threads, or the
+  // current count if 0, and return the lowest latency in
+  // microseconds, or -1 if forward() failed.
+  std::string latencies;
+  auto run_iterations = [&](const int thread_count) -> int64_t {
+    int64_t min_us = -1;
+    latencies.clear();
+    for (int i = 0; i < iterations; ++i) {
+      const auto start = std::chrono::steady_clock::now();
+      try {
+        torch::NoGradGuard no_grad;
+        ScopedIntraOpThreads intra_op_threads(thread_count);
+        model->forward(input_tensors);
+#ifdef TRITON_ENABLE_GPU
+        if (device_.is_cuda()) {
+          cudaDeviceSynchronize();
+        }
+#endif  // TRITON_ENABLE_GPU
+      }
+      catch (const std::exception& ex) {
+        LOG_MESSAGE(
+            TRITONSERVER_LOG_WARN,
+            (std::string("warmup of '") + Name() + "' with " + shape_str +
+             " failed: " + ex.what())
+                .c_str());
+        return -1;
+      }
+
+      const int64_t us =
+          std::chrono::duration_cast<std::chrono::microseconds>(
+              std::chrono::steady_clock::now() - start)
+              .count();
+      latencies += (latencies.empty() ? "" : ", ") + std::to_string(us);
+      min_us = ((min_us < 0) || (us < min_us)) ? us : min_us;
+    }
+    return min_us;
+  };
+
+  const int64_t default_us = run_iterations(0 /* thread_count */);
+  LOG_MESSAGE(
+      TRITONSERVER_LOG_INFO,
+      (std::string("warmup of '") + Name() + "' with " + shape_str +
+       ", per-iteration latency (us): " + latencies)
+          .c_str());
+  if ((default_us < 0) || !model_state_->LearnIntraOpThreads() ||
+      device_.is_cuda()) {
+    return;
+  }
+
+  // Learn the thread count for this batch size by timing powers of two
+  // up to the count the instance runs with otherwise.
+  const int max_thread_count = (intra_op_thread_count_ > 0)
+                                   ? intra_op_thread_count_
+                                   : at::get_num_threads();
+  int best_thread_count = max_thread_count;
+  int64_t best_us = -1;
+  std::string results;
+  for (int thread_count = 1; thread_count <= max_thread_count;
+       thread_count = std::min(thread_count * 2, max_thread_count)) {
+    const int64_t us = run_iterations(thread_count);
+    if (us < 0) {
+      return;
+    }
+    results += (results.empty() ? "" : ", ") + std::to_string(thread_count) +
+               ": " + std::to_string(us);
+    if ((best_us < 0) || (us < best_us)) {
+      best_us = us;
+      best_thread_count = thread_count;
+    }
+    if (thread_count == max_thread_count) {
+      break;
+    }
+  }
+
+  threads_by_batch_.emplace_back(
+      std::max<int64_t>(batch_size, 1), best_thread_count);
+  LOG_MESSAGE(
+      TRITONSERVER_LOG_INFO,
+      (std::string("using ") + std::to_string(best_thread_count) +
+       " intra-op threads for '" + Name() + "' with " + shape_str +
+       ", lowest latency (us) by thread count: " + results)
+          .c_str());
+}
+
+TRITONSERVER_Error*
+ModelInstanceState::ValidateBooleanSequenceControl(
+    triton::common::TritonJson::Value& sequence_batching,
+    const std::string& control_kind, bool required, bool* have_control)
+{
+  std::string tensor_name;
+  std::string tensor_datatype;
+  RETURN_IF_ERROR(GetBooleanSequenceControlProperties(
+      sequence_batching, model_state_->Name(), control_kind, required,
+      &tensor_name, &tensor_datatype, nullptr, nullptr, nullptr, nullptr));
+  *have_control = !tensor_name.empty();
+  if (*have_control) {
+    const auto pr = ModelConfigDataTypeToTorchType(tensor_datatype);
+    if (!pr.first) {
+      return TRITONSERVER_ErrorNew(
+          TRITONSERVER_ERROR_INTERNAL,
+          ("unsupported datatype " + tensor_datatype + " for input '" +
+           tensor_name + "' for model '" + model_state_->Name() + "'")
+              .c_str());
+    }
+    input_bindings_.push_back(
+        {tensor_name, pr.second, {1}, false /* optional */,
+         false /* ragged */, NamingConventionIndex(tensor_name),
+         -1 /* arg_index */, nullptr /* ingress */});
+  }
+
+  return nullptr;  // success
+}
 
 TRITONSERVER_Error*
 ModelInstanceState::ValidateTypedSequenceControl(
@@ -397,23 +2737,18 @@ ModelInstanceState::ValidateTypedSequenceControl(
       &tensor_name, &tensor_datatype));
   *have_control = !tensor_name.empty();
   if (*have_control) {
-    std::string deliminator = "__";
-    int ip_index = 0;
-    try {
-      int start_pos = tensor_name.find(deliminator);
-      if (start_pos == -1) {
-        throw std::invalid_argument("input must follow naming convention");
-      }
-      ip_index = std::atoi(tensor_name.substr(start_pos + 2).c_str());
-      input_index_map_[tensor_name] = ip_index;
-    }
-    catch (std::exception& ex) {
+    const auto pr = ModelConfigDataTypeToTorchType(tensor_datatype);
+    if (!pr.first) {
       return TRITONSERVER_ErrorNew(
           TRITONSERVER_ERROR_INTERNAL,
-          ("input '" + tensor_name +
-           "' does not follow naming convention i.e. <name>__<index>.")
+          ("unsupported datatype " + tensor_datatype + " for input '" +
+           tensor_name + "' for model '" + model_state_->Name() + "'")
               .c_str());
     }
+    input_bindings_.push_back(
+        {tensor_name, pr.second, {1}, false /* optional */,
+         false /* ragged */, NamingConventionIndex(tensor_name),
+         -1 /* arg_index */, nullptr /* ingress */});
   }
 
   return nullptr;  // success
@@ -424,31 +2759,15 @@ ModelInstanceState::ValidateInputs()
 {
   triton::common::TritonJson::Value ios;
   RETURN_IF_ERROR(model_state_->ModelConfig().MemberAsArray("input", &ios));
-  std::string deliminator = "__";
-  int ip_index = 0;
 
   for (size_t i = 0; i < ios.ArraySize(); i++) {
     triton::common::TritonJson::Value io;
     RETURN_IF_ERROR(ios.IndexAsObject(i, &io));
 
-    // Validate name
+    // The name is matched against the forward() arguments once the
+    // model is loaded, see BindInputs().
     std::string io_name;
     RETURN_IF_ERROR(io.MemberAsString("name", &io_name));
-    try {
-      int start_pos = io_name.find(deliminator);
-      if (start_pos == -1) {
-        throw std::invalid_argument("input must follow naming convention");
-      }
-      ip_index = std::atoi(io_name.substr(start_pos + 2).c_str());
-      input_index_map_[io_name] = ip_index;
-    }
-    catch (std::exception& ex) {
-      return TRITONSERVER_ErrorNew(
-          TRITONSERVER_ERROR_INTERNAL,
-          ("input '" + io_name +
-           "' does not follow naming convention i.e. <name>__<index>.")
-              .c_str());
-    }
 
     // Validate data type
     std::string io_dtype;
@@ -461,6 +2780,192 @@ ModelInstanceState::ValidateInputs()
            "' for model '" + model_state_->Name() + "'")
               .c_str());
     }
+
+    // The backend sees inputs after any reshape has been applied.
+    std::vector<int64_t> dims;
+    triton::common::TritonJson::Value reshape;
+    if (io.Find("reshape", &reshape)) {
+      RETURN_IF_ERROR(ParseShape(reshape, "shape", &dims));
+    } else {
+      RETURN_IF_ERROR(ParseShape(io, "dims", &dims));
+    }
+
+    // Requests may omit an optional input, in which case the forward()
+    // argument keeps its default value.
+    bool optional = false;
+    if (io.Find("optional")) {
+      RETURN_IF_ERROR(io.MemberAsBool("optional", &optional));
+    }
+
+    // Ragged inputs of the requests are concatenated, which only
+    // applies to models that batch.
+    bool ragged = false;
+    if (io.Find("allow_ragged_batch") && (model_state_->MaxBatchSize() > 0)) {
+      RETURN_IF_ERROR(io.MemberAsBool("allow_ragged_batch", &ragged));
+    }
+    ragged_batching_ |= ragged;
+
+    // A converted input is passed to forward() in the datatype of its
+    // conversion.
+    const ModelState::IngressConversion* ingress =
+        model_state_->InputConversion(io_name);
+    if ((ingress != nullptr) && (ingress->dtype == pr.second)) {
+      return TRITONSERVER_ErrorNew(
+          TRITONSERVER_ERROR_INVALID_ARG,
+          ("INGRESS_CONVERSION of input '" + io_name + "' for model '" +
+           model_state_->Name() + "' must convert from " + io_dtype +
+           " to another datatype")
+              .c_str());
+    }
+
+    input_bindings_.push_back(
+        {io_name, (ingress != nullptr) ? ingress->dtype : pr.second, dims,
+         optional, ragged, NamingConventionIndex(io_name),
+         -1 /* arg_index */, ingress});
+  }
+
+  return nullptr;  // success
+}
+
+TRITONSERVER_Error*
+ModelInstanceState::BindGeneratedArgument(
+    const std::vector<c10::Argument>& arguments, const std::string& param,
+    const std::string& name, std::vector<bool>* bound, int* arg_index)
+{
+  *arg_index = -1;
+  for (size_t i = 0; i < arguments.size(); ++i) {
+    if (arguments[i].name() == name) {
+      *arg_index = i;
+      break;
+    }
+  }
+
+  if (*arg_index < 0) {
+    return TRITONSERVER_ErrorNew(
+        TRITONSERVER_ERROR_INVALID_ARG,
+        (param + " of model '" + model_state_->Name() +
+         "' must name a forward() argument, got '" + name + "'")
+            .c_str());
+  }
+  if ((*bound)[*arg_index]) {
+    return TRITONSERVER_ErrorNew(
+        TRITONSERVER_ERROR_INVALID_ARG,
+        (param + " '" + name + "' of model '" + model_state_->Name() +
+         "' is already bound to a model input")
+            .c_str());
+  }
+  (*bound)[*arg_index] = true;
+
+  return nullptr;  // success
+}
+
+TRITONSERVER_Error*
+ModelInstanceState::BindInputs()
+{
+  std::vector<c10::Argument> arguments;
+  try {
+    arguments =
+        torch_model_->get_method("forward").function().getSchema().arguments();
+  }
+  catch (const std::exception& ex) {
+    return TRITONSERVER_ErrorNew(
+        TRITONSERVER_ERROR_INTERNAL,
+        ("failed to read the forward() schema of model '" +
+         model_state_->Name() + "': " + ex.what())
+            .c_str());
+  }
+
+  // The first schema argument is the module itself.
+  if (!arguments.empty()) {
+    arguments.erase(arguments.begin());
+  }
+  forward_arg_count_ = arguments.size();
+
+  // An input whose name matches a forward() argument is bound to that
+  // argument, otherwise the <name>__<index> naming convention decides.
+  std::vector<bool> bound(forward_arg_count_, false);
+  for (auto& binding : input_bindings_) {
+    binding.arg_index = binding.name_index;
+    for (size_t i = 0; i < arguments.size(); ++i) {
+      if (arguments[i].name() == binding.name) {
+        binding.arg_index = i;
+        break;
+      }
+    }
+
+    if (binding.arg_index < 0) {
+      return TRITONSERVER_ErrorNew(
+          TRITONSERVER_ERROR_INVALID_ARG,
+          ("input '" + binding.name + "' for model '" + model_state_->Name() +
+           "' does not match any forward() argument name and does not "
+           "follow naming convention i.e. <name>__<index>.")
+              .c_str());
+    }
+    if (static_cast<size_t>(binding.arg_index) >= forward_arg_count_) {
+      return TRITONSERVER_ErrorNew(
+          TRITONSERVER_ERROR_INVALID_ARG,
+          ("input '" + binding.name + "' for model '" + model_state_->Name() +
+           "' refers to argument index " + std::to_string(binding.arg_index) +
+           " but forward() takes " + std::to_string(forward_arg_count_) +
+           " arguments")
+              .c_str());
+    }
+    if (bound[binding.arg_index]) {
+      return TRITONSERVER_ErrorNew(
+          TRITONSERVER_ERROR_INVALID_ARG,
+          ("input '" + binding.name + "' for model '" + model_state_->Name() +
+           "' is bound to forward() argument '" +
+           arguments[binding.arg_index].name() +
+           "' which is already bound to another input")
+              .c_str());
+    }
+    if (binding.optional &&
+        !arguments[binding.arg_index].default_value().has_value()) {
+      return TRITONSERVER_ErrorNew(
+          TRITONSERVER_ERROR_INVALID_ARG,
+          ("optional input '" + binding.name + "' for model '" +
+           model_state_->Name() + "' is bound to forward() argument '" +
+           arguments[binding.arg_index].name() +
+           "' which has no default value")
+              .c_str());
+    }
+    bound[binding.arg_index] = true;
+  }
+
+  ragged_offsets_arg_index_ = -1;
+  padding_mask_arg_index_ = -1;
+  if (ragged_batching_) {
+    if (model_state_->RaggedBatchingMode() ==
+        ModelState::RaggedBatching::PAD) {
+      if (!model_state_->PaddingMaskArgument().empty()) {
+        RETURN_IF_ERROR(BindGeneratedArgument(
+            arguments, "PADDING_MASK_ARGUMENT",
+            model_state_->PaddingMaskArgument(), &bound,
+            &padding_mask_arg_index_));
+      }
+    } else {
+      RETURN_IF_ERROR(BindGeneratedArgument(
+          arguments, "RAGGED_OFFSETS_ARGUMENT",
+          model_state_->RaggedOffsetsArgument(), &bound,
+          &ragged_offsets_arg_index_));
+    }
+  }
+
+  // Arguments without an input, and optional inputs that a request
+  // omits, are passed their default value.
+  default_args_.assign(forward_arg_count_, torch::jit::IValue());
+  for (size_t i = 0; i < arguments.size(); ++i) {
+    const auto& default_value = arguments[i].default_value();
+    if (default_value.has_value()) {
+      default_args_[i] = *default_value;
+    } else if (!bound[i]) {
+      return TRITONSERVER_ErrorNew(
+          TRITONSERVER_ERROR_INVALID_ARG,
+          ("forward() argument '" + arguments[i].name() + "' of model '" +
+           model_state_->Name() +
+           "' has no default value and no model input is bound to it")
+              .c_str());
+    }
   }
 
   return nullptr;  // success
@@ -496,19 +3001,88 @@ ModelInstanceState::ValidateOutputs()
               .c_str());
     }
 
-    // Validate data type
+    // Validate data type. A classification output holds strings
+    // whatever the type of the model output.
     std::string io_dtype;
     RETURN_IF_ERROR(io.MemberAsString("data_type", &io_dtype));
-    const auto pr = ModelConfigDataTypeToTorchType(io_dtype);
-    if (!pr.first) {
+    const ModelState::Classification* classification =
+        model_state_->OutputClassification(io_name);
+    TRITONSERVER_DataType dtype = TRITONSERVER_TYPE_BYTES;
+    if (classification != nullptr) {
+      if (io_dtype != "TYPE_STRING") {
+        return TRITONSERVER_ErrorNew(
+            TRITONSERVER_ERROR_INVALID_ARG,
+            ("classification output '" + io_name + "' for model '" +
+             model_state_->Name() + "' must be TYPE_STRING")
+                .c_str());
+      }
+    } else {
+      const auto pr = ModelConfigDataTypeToTorchType(io_dtype);
+      if (!pr.first) {
+        return TRITONSERVER_ErrorNew(
+            TRITONSERVER_ERROR_INTERNAL,
+            ("unsupported datatype " + io_dtype + " for output '" + io_name +
+             "' for model '" + model_state_->Name() + "'")
+                .c_str());
+      }
+      dtype = ConvertTorchTypeToDataType(pr.second);
+    }
+    if (op_index < 0) {
       return TRITONSERVER_ErrorNew(
-          TRITONSERVER_ERROR_INTERNAL,
-          ("unsupported datatype " + io_dtype + " for output '" + io_name +
-           "' for model '" + model_state_->Name() + "'")
+          TRITONSERVER_ERROR_INVALID_ARG,
+          ("output '" + io_name + "' for model '" + model_state_->Name() +
+           "' refers to a negative output index")
               .c_str());
     }
-    output_index_map_[io_name] = op_index;
-    output_dtype_map_[io_name] = ConvertTorchTypeToDataType(pr.second);
+    std::vector<int64_t> dims;
+    triton::common::TritonJson::Value reshape;
+    if (io.Find("reshape", &reshape)) {
+      RETURN_IF_ERROR(ParseShape(reshape, "shape", &dims));
+    } else {
+      RETURN_IF_ERROR(ParseShape(io, "dims", &dims));
+    }
+
+    // The rows of a concatenated ragged batch are not those of its
+    // requests, and classes are picked from one row per request.
+    if ((classification != nullptr) && ragged_batching_ &&
+        (model_state_->RaggedBatchingMode() ==
+         ModelState::RaggedBatching::CONCATENATE)) {
+      return TRITONSERVER_ErrorNew(
+          TRITONSERVER_ERROR_INVALID_ARG,
+          ("classification output '" + io_name + "' for model '" +
+           model_state_->Name() +
+           "' is not supported with RAGGED_BATCHING \"concatenate\"")
+              .c_str());
+    }
+    if ((classification != nullptr) &&
+        ((dims.size() != 1) ||
+         ((dims[0] != -1) && (dims[0] != classification->k)))) {
+      return TRITONSERVER_ErrorNew(
+          TRITONSERVER_ERROR_INVALID_ARG,
+          ("classification output '" + io_name + "' for model '" +
+           model_state_->Name() + "' must have dims [" +
+           std::to_string(classification->k) + "] or [-1]")
+              .c_str());
+    }
+
+    // Floating-point results can be converted to a narrower type on
+    // egress.
+    const double egress_scale = model_state_->EgressScale(io_name);
+    if ((egress_scale > 0) &&
+        ((classification != nullptr) ||
+         ((dtype != TRITONSERVER_TYPE_FP16) &&
+          (dtype != TRITONSERVER_TYPE_BF16) &&
+          (dtype != TRITONSERVER_TYPE_INT8)))) {
+      return TRITONSERVER_ErrorNew(
+          TRITONSERVER_ERROR_INVALID_ARG,
+          ("EGRESS_CONVERSION output '" + io_name + "' for model '" +
+           model_state_->Name() + "' must be TYPE_FP16, TYPE_BF16 or TYPE_INT8")
+              .c_str());
+    }
+
+    output_bindings_.push_back(
+        {io_name, dtype, dims, op_index, classification, egress_scale});
+    max_output_index_ = std::max(max_output_index_, op_index);
   }
 
   return nullptr;  // success
@@ -517,6 +3091,48 @@ ModelInstanceState::ValidateOutputs()
 void
 ModelInstanceState::ProcessRequests(
     TRITONBACKEND_Request** requests, const uint32_t request_count)
+{
+  if (worker_pool_ == nullptr) {
+    ExecuteRequests(requests, request_count, 0 /* worker */);
+    return;
+  }
+
+  // Triton doesn't call this concurrently for the same instance, so a
+  // lazy instance loads its model here rather than on several workers
+  // at once.
+  TRITONSERVER_Error* err = EnsureModelLoaded();
+  if (err != nullptr) {
+    RequestsRespondWithError(requests, request_count, err);
+    return;
+  }
+
+  // At most one execution per worker is in flight. Blocking until a
+  // worker is free keeps the remaining requests in Triton's queue, where
+  // the dynamic batcher can still batch them and queue delays, sizes,
+  // timeouts and priorities still apply.
+  {
+    std::unique_lock<std::mutex> lk(async_mu_);
+    async_cv_.wait(
+        lk, [this] { return async_pending_ < worker_pool_->Size(); });
+    ++async_pending_;
+  }
+  std::vector<TRITONBACKEND_Request*> async_requests(
+      requests, requests + request_count);
+  worker_pool_->Enqueue([this, async_requests](size_t worker) mutable {
+    ExecuteRequests(async_requests.data(), async_requests.size(), worker);
+
+    // Notified under the lock since the destructor may be waiting to
+    // destroy the condition variable.
+    std::lock_guard<std::mutex> lk(async_mu_);
+    --async_pending_;
+    async_cv_.notify_all();
+  });
+}
+
+void
+ModelInstanceState::ExecuteRequests(
+    TRITONBACKEND_Request** requests, const uint32_t request_count,
+    const size_t worker)
 {
   LOG_MESSAGE(
       TRITONSERVER_LOG_VERBOSE,
@@ -534,6 +3150,8 @@ ModelInstanceState::ProcessRequests(
   // input has already been checked so don't need to do that here.
   /* 以下收集送到backend的所有request的batch_size总和, 并检查是否超过max_batch_size */
   size_t total_batch_size = 0;
+  std::vector<int64_t> request_batch_sizes;
+  request_batch_sizes.reserve(request_count);
   for (size_t i = 0; i < request_count; i++) {
     // If we get a nullptr request then something is badly wrong. Fail
     // and release all requests.
@@ -560,7 +3178,10 @@ ModelInstanceState::ProcessRequests(
         const int64_t* shape;
         err = TRITONBACKEND_InputProperties(
             input, nullptr, nullptr, &shape, nullptr, nullptr, nullptr);
-        total_batch_size += shape[0];
+        if (err == nullptr) {
+          total_batch_size += shape[0];
+          request_batch_sizes.push_back(shape[0]);
+        }
       }
       if (err != nullptr) {
         RequestsRespondWithError(requests, request_count, err);
@@ -568,6 +3189,7 @@ ModelInstanceState::ProcessRequests(
       }
     } else {
       total_batch_size += 1;
+      request_batch_sizes.push_back(1);
     }
   }
 
@@ -576,6 +3198,18 @@ ModelInstanceState::ProcessRequests(
     return;
   }
 
+  // A lazily loaded instance materializes its model on the first
+  // execution.
+  {
+    TRITONSERVER_Error* err = EnsureModelLoaded();
+    if (err != nullptr) {
+      RequestsRespondWithError(requests, request_count, err);
+      return;
+    }
+  }
+  ApplyThreadSettings(worker);
+  BufferArena* arena = input_arenas_[worker].get();
+
   // Make sure the maximum batch size is not exceeded. The
   // total_batch_size must be 1 for models that don't support batching
   // (i.e. max_batch_size == 0). If max_batch_size is exceeded then
@@ -622,55 +3256,240 @@ ModelInstanceState::ProcessRequests(
     }
   }
 
-  std::vector<const char*> input_names;
-  std::vector<torch::jit::IValue> input_tensors;
-  std::vector<BackendMemory*> input_memories;
+  // Requests of a padded batch are split into batches of similar
+  // length, otherwise all requests execute together. When pipelining,
+  // each batch is further split into micro-batches.
+  std::vector<std::vector<uint32_t>> groups;
+  GroupRequestsByLength(requests, request_count, &groups);
+  if (groups.empty()) {
+    groups.emplace_back(request_count);
+    for (uint32_t r = 0; r < request_count; ++r) {
+      groups.back()[r] = r;
+    }
+  }
+  if (pipeline_pool_ != nullptr) {
+    SplitMicroBatches(request_batch_sizes, &groups);
+  }
+
+  std::vector<MicroBatch> batches(groups.size());
+  for (size_t g = 0; g < groups.size(); ++g) {
+    MicroBatch& batch = batches[g];
+    batch.total_batch_size = 0;
+    batch.arena = arena;
+    batch.buffer_set = 0;
+    batch.failed = false;
+    for (const uint32_t r : groups[g]) {
+      batch.requests.push_back(requests[r]);
+      batch.responses.push_back(responses[r]);
+      batch.request_batch_sizes.push_back(request_batch_sizes[r]);
+      batch.total_batch_size += request_batch_sizes[r];
+    }
+  }
+
+  const bool pipelined = (pipeline_pool_ != nullptr) && (batches.size() > 1);
+  if (pipelined) {
+    // The responses of each micro-batch are sent as soon as it is
+    // scattered.
+    RunPipeline(&batches, exec_start_ns);
+  } else {
+    for (size_t g = 0; g < batches.size(); ++g) {
+      GatherBatch(&batches[g]);
+      ForwardBatch(&batches[g]);
+      ScatterBatch(&batches[g]);
+
+      // A response that failed has been sent and set to nullptr.
+      for (size_t i = 0; i < groups[g].size(); ++i) {
+        responses[groups[g][i]] = batches[g].responses[i];
+      }
+    }
+  }
+  const uint64_t compute_start_ns = batches.front().compute_start_ns;
+  const uint64_t compute_end_ns = batches.back().compute_end_ns;
+
+  // The input buffers go back to the arena for the next execution.
+  arena->EndExecution();
+
+  CopyStats gather_stats;
+  CopyStats scatter_stats;
+  size_t skipped_output_count = 0;
+  for (const auto& batch : batches) {
+    gather_stats.bytes += batch.gather_stats.bytes;
+    gather_stats.copy_ns += batch.gather_stats.copy_ns;
+    scatter_stats.bytes += batch.scatter_stats.bytes;
+    scatter_stats.copy_ns += batch.scatter_stats.copy_ns;
+    skipped_output_count += batch.skipped_output_count;
+  }
+  LOG_MESSAGE(
+      TRITONSERVER_LOG_VERBOSE,
+      (std::string("'") + Name() + "' gathered " +
+       std::to_string(gather_stats.bytes) + " input bytes in " +
+       std::to_string(gather_stats.copy_ns / 1000) + " us, scattered " +
+       std::to_string(scatter_stats.bytes) + " output bytes in " +
+       std::to_string(scatter_stats.copy_ns / 1000) + " us" +
+       (pipelined ? " over " + std::to_string(batches.size()) +
+                        " micro-batches"
+                  : std::string()) +
+       ", skipped " + std::to_string(skipped_output_count) +
+       " unrequested outputs")
+          .c_str());
+  {
+    std::lock_guard<std::mutex> lk(stats_mu_);
+    gather_stats_.bytes += gather_stats.bytes;
+    gather_stats_.copy_ns += gather_stats.copy_ns;
+    scatter_stats_.bytes += scatter_stats.bytes;
+    scatter_stats_.copy_ns += scatter_stats.copy_ns;
+    skipped_output_count_ += skipped_output_count;
+  }
+  if ((skipped_outputs_metric_ != nullptr) && (skipped_output_count > 0)) {
+    LOG_IF_ERROR(
+        TRITONSERVER_MetricIncrement(
+            skipped_outputs_metric_, skipped_output_count),
+        "failed to count skipped outputs");
+  }
+
+  uint64_t exec_end_ns = 0;
+  SET_TIMESTAMP(exec_end_ns);
+
+  if (!pipelined) {
+    CompleteRequests(
+        requests, request_count, &responses, exec_start_ns, compute_start_ns,
+        compute_end_ns, exec_end_ns);
+  }
+
+  // Report the entire batch statistics.
+  LOG_IF_ERROR(
+      TRITONBACKEND_ModelInstanceReportBatchStatistics(
+          TritonModelInstance(), total_batch_size, exec_start_ns,
+          compute_start_ns, compute_end_ns, exec_end_ns),
+      "failed reporting batch request statistics");
+}
+
+void
+ModelInstanceState::SplitMicroBatches(
+    const std::vector<int64_t>& request_batch_sizes,
+    std::vector<std::vector<uint32_t>>* groups)
+{
+  const int64_t micro_batch_size = model_state_->MicroBatchSize();
+  std::vector<std::vector<uint32_t>> micro_batches;
+  for (const auto& group : *groups) {
+    // Requests are never split, so a request larger than a micro-batch
+    // is executed on its own.
+    int64_t batch_size = 0;
+    for (const uint32_t r : group) {
+      if ((batch_size == 0) ||
+          (batch_size + request_batch_sizes[r] > micro_batch_size)) {
+        micro_batches.emplace_back();
+        batch_size = 0;
+      }
+      micro_batches.back().push_back(r);
+      batch_size += request_batch_sizes[r];
+    }
+  }
+  groups->swap(micro_batches);
+}
+
+void
+ModelInstanceState::GroupRequestsByLength(
+    TRITONBACKEND_Request** requests, const uint32_t request_count,
+    std::vector<std::vector<uint32_t>>* groups)
+{
+  groups->clear();
+  if (!ragged_batching_ ||
+      (model_state_->RaggedBatchingMode() !=
+       ModelState::RaggedBatching::PAD) ||
+      (request_count < 2)) {
+    return;
+  }
+
+  // All ragged inputs have the same lengths so the first one decides.
+  // Errors are reported when the inputs are gathered.
+  std::vector<int64_t> lengths;
+  for (const auto& binding : input_bindings_) {
+    if (binding.ragged) {
+      std::vector<int64_t> batchn_shape;
+      TRITONSERVER_Error* err = RaggedInputShape(
+          binding.name.c_str(), requests, request_count, &batchn_shape,
+          &lengths);
+      if (err != nullptr) {
+        TRITONSERVER_ErrorDelete(err);
+        return;
+      }
+      break;
+    }
+  }
+  if (lengths.empty()) {
+    return;
+  }
+
+  std::vector<uint32_t> order(request_count);
+  for (uint32_t r = 0; r < request_count; ++r) {
+    order[r] = r;
+  }
+  std::stable_sort(
+      order.begin(), order.end(),
+      [&lengths](const uint32_t a, const uint32_t b) {
+        return lengths[a] < lengths[b];
+      });
+
+  // In ascending order each request is the longest of its group so far,
+  // start a new group when padding all others to it would waste too
+  // much of the batch.
+  const int64_t max_padding_percent = model_state_->MaxPaddingPercent();
+  int64_t group_length_sum = 0;
+  for (const uint32_t r : order) {
+    if (!groups->empty()) {
+      const int64_t padded_size =
+          (groups->back().size() + 1) * lengths[r];
+      const int64_t padding = padded_size - (group_length_sum + lengths[r]);
+      if (padding * 100 <= max_padding_percent * padded_size) {
+        groups->back().push_back(r);
+        group_length_sum += lengths[r];
+        continue;
+      }
+    }
+    groups->emplace_back(1, r);
+    group_length_sum = lengths[r];
+  }
+}
+
+void
+ModelInstanceState::GatherBatch(MicroBatch* batch)
+{
+  const uint32_t request_count = batch->requests.size();
   bool cuda_copy = false;
+
+  // The batch is padded up to its bucket, if any.
+  batch->padded_batch_size =
+      (model_state_->MaxBatchSize() > 0)
+          ? RoundUpToBucket(batch_buckets_, batch->total_batch_size)
+          : batch->total_batch_size;
+  batch->padded_length = 0;
+
   /* 创建工具类的对象collector, 用于准备输入Tensors的 */
   BackendInputCollector collector(
-      requests, request_count, &responses, model_state_->TritonMemoryManager() /* 定义在ModelState的基类BackendModel中*/,
+      batch->requests.data(), request_count, &batch->responses,
+      model_state_->TritonMemoryManager() /* 定义在ModelState的基类BackendModel中*/,
       model_state_->EnablePinnedInput(), CudaStream());
   /* 着手准备输入Tensors, 包括为每个input创建buffer(大小为所有request中该input tensor的size之和), */
   /* 将送来所有request中的input都聚合为大的batch，以及把request中的输入数据拷贝到input buffer中 */
   SetInputTensors(
-      total_batch_size, requests, request_count, &responses, &collector,
-      &input_names, &input_tensors, &input_memories, &cuda_copy);
-
-  // Request to retrieve all model outputs. 'output_names' and
-  // 'output_tensors' are parallel vectors and so must be kept in
-  // sync.
-  /* 获取每个输出tensor的名称 */
-  std::vector<const char*> output_names;
-  std::vector<torch::Tensor> output_tensors;
-  {
-    triton::common::TritonJson::Value ios;
-    TRITONSERVER_Error* err =
-        model_state_->ModelConfig().MemberAsArray("output", &ios);
-
-    if (err == nullptr) {
-      for (size_t i = 0; i < ios.ArraySize(); i++) {
-        triton::common::TritonJson::Value io;
-        err = ios.IndexAsObject(i, &io);
-        if (err != nullptr) {
-          break;
-        }
-
-        // Use names from ModelConfig by reference since the model
-        // config will persist longer than this inference execution.
-        const char* io_name;
-        size_t io_name_len;
-        err = io.MemberAsString("name", &io_name, &io_name_len);
-        if (err != nullptr) {
-          break;
-        }
-
-        output_names.emplace_back(io_name);
-      }
-    }
-
-    if (err != nullptr) {
-      SendErrorForResponses(&responses, request_count, err);
-      output_names.clear();
+      batch->total_batch_size, batch->padded_batch_size, batch->arena,
+      batch->buffer_set, batch->requests.data(), request_count,
+      &batch->responses, &collector, &batch->input_tensors,
+      &batch->ragged_lengths, &batch->padded_length, &batch->gather_stats,
+      &cuda_copy);
+
+  // Run the module compiled for the buckets of this batch. A batch
+  // beyond the largest bucket runs on the unbucketed module.
+  batch->model = torch_model_.get();
+  if (!bucket_models_.empty()) {
+    const auto itr = bucket_models_.find(std::make_pair(
+        batch_buckets_.empty()
+            ? int64_t(0)
+            : static_cast<int64_t>(batch->padded_batch_size),
+        sequence_buckets_.empty() ? int64_t(0) : batch->padded_length));
+    if (itr != bucket_models_.end()) {
+      batch->model = itr->second.get();
     }
   }
 
@@ -682,41 +3501,99 @@ ModelInstanceState::ProcessRequests(
   }
 #endif
 
-  uint64_t compute_start_ns = 0;
-  SET_TIMESTAMP(compute_start_ns);
+  // Converted inputs that were gathered as sent, on GPU or padded, are
+  // converted once copied. As when converted while gathered, only the
+  // values of the requests are converted and the padding stays zero.
+  const bool padded_ragged =
+      model_state_->RaggedBatchingMode() == ModelState::RaggedBatching::PAD;
+  for (const auto& binding : input_bindings_) {
+    if ((binding.ingress == nullptr) || (binding.arg_index < 0)) {
+      continue;
+    }
+    torch::jit::IValue& arg = batch->input_tensors[binding.arg_index];
+    if (!arg.isTensor() ||
+        (arg.toTensor().scalar_type() == binding.ingress->dtype)) {
+      continue;
+    }
+    try {
+      const torch::Tensor src = arg.toTensor();
+      torch::Tensor converted = torch::zeros(
+          src.sizes(), torch::TensorOptions(binding.ingress->dtype)
+                           .device(src.device()));
+      if (binding.ragged && padded_ragged) {
+        // Row 'r' holds the 'ragged_lengths[r]' values of request 'r'.
+        for (size_t r = 0; r < batch->ragged_lengths.size(); ++r) {
+          torch::Tensor dst =
+              converted.select(0, r).narrow(0, 0, batch->ragged_lengths[r]);
+          ConvertIngress(
+              *binding.ingress,
+              src.select(0, r).narrow(0, 0, batch->ragged_lengths[r]), &dst);
+        }
+      } else if ((model_state_->MaxBatchSize() > 0) && !binding.ragged) {
+        // Rows beyond those of the requests pad the batch to its bucket.
+        torch::Tensor dst = converted.narrow(0, 0, batch->total_batch_size);
+        ConvertIngress(
+            *binding.ingress, src.narrow(0, 0, batch->total_batch_size),
+            &dst);
+      } else {
+        ConvertIngress(*binding.ingress, src, &converted);
+      }
+      arg = converted;
+    }
+    catch (const std::exception& ex) {
+      RESPOND_ALL_AND_RETURN_IF_ERROR(
+          &batch->responses, request_count,
+          TRITONSERVER_ErrorNew(
+              TRITONSERVER_ERROR_INTERNAL,
+              (std::string("failed to convert input '") + binding.name +
+               "': " + ex.what())
+                  .c_str()));
+    }
+  }
+}
+
+void
+ModelInstanceState::ForwardBatch(MicroBatch* batch)
+{
+  SET_TIMESTAMP(batch->compute_start_ns);
 
   // Run...
   /* 执行真正的推理 */
-  Execute(&responses, request_count, &input_tensors, &output_tensors);
+  Execute(
+      batch->model, &batch->responses, batch->requests.size(),
+      batch->padded_batch_size, &batch->input_tensors,
+      &batch->output_tensors);
 
-  uint64_t compute_end_ns = 0;
-  SET_TIMESTAMP(compute_end_ns);
+  SET_TIMESTAMP(batch->compute_end_ns);
+}
 
-  // Free BackendMemory used for inputs
-  for (BackendMemory* mem : input_memories) {
-    delete mem;
-  }
-  input_memories.clear();
+void
+ModelInstanceState::ScatterBatch(MicroBatch* batch)
+{
+  const uint32_t request_count = batch->requests.size();
+  std::vector<TRITONBACKEND_Response*>* responses = &batch->responses;
+  const std::vector<torch::Tensor>& output_tensors = batch->output_tensors;
 
   // Verify output indices are valid with number of outputs after execution
   /* 检查config定义的输出tensor的index是否在合理范围内(大于0小于实际输出的tensor数量) */
   bool invalid_index = false;
   int max_index = output_tensors.size() - 1;
-  for (const auto& name : output_names) {
-    int op_index = output_index_map_[name];
-    if ((op_index < 0) || (op_index > max_index)) {
-      SendErrorForResponses(
-          &responses, request_count,
-          TRITONSERVER_ErrorNew(
-              TRITONSERVER_ERROR_INVALID_ARG,
-              std::string(
-                  "The output " + std::string(name) +
-                  " in the model configuration refers to an output index which"
-                  " doesn't exist. This model has " +
-                  std::to_string(max_index + 1) + " outputs")
-                  .c_str()));
-      invalid_index = true;
-      break;
+  if (max_output_index_ > max_index) {
+    for (const auto& binding : output_bindings_) {
+      if (binding.output_index > max_index) {
+        SendErrorForResponses(
+            responses, request_count,
+            TRITONSERVER_ErrorNew(
+                TRITONSERVER_ERROR_INVALID_ARG,
+                std::string(
+                    "The output " + binding.name +
+                    " in the model configuration refers to an output index "
+                    "which doesn't exist. This model has " +
+                    std::to_string(max_index + 1) + " outputs")
+                    .c_str()));
+        invalid_index = true;
+        break;
+      }
     }
   }
 
@@ -724,19 +3601,140 @@ ModelInstanceState::ProcessRequests(
   /* 主要将batch的输出tensor中，属于各个request的部分取出来，放到其对应的response中 */
   if (!invalid_index) {
     ReadOutputTensors(
-        total_batch_size, output_names, output_tensors, requests, request_count,
-        &responses);
+        batch->total_batch_size, batch->padded_batch_size,
+        batch->padded_length, output_tensors, batch->requests.data(),
+        request_count, batch->request_batch_sizes, batch->ragged_lengths,
+        responses, &batch->scatter_stats, &batch->skipped_output_count);
   }
 
-  uint64_t exec_end_ns = 0;
-  SET_TIMESTAMP(exec_end_ns);
+  // The outputs may be views of the inputs, so both are dropped only
+  // once the outputs are scattered.
+  batch->input_tensors.clear();
+  batch->output_tensors.clear();
+}
+
+void
+ModelInstanceState::RunPipeline(
+    std::vector<MicroBatch>* batches, const uint64_t exec_start_ns)
+{
+  // Micro-batch 'k' is gathered on one pipeline thread while 'k - 1'
+  // runs forward() on this thread and 'k - 2' is scattered and sent on
+  // the other pipeline thread. A micro-batch holds its set of input
+  // buffers until it is scattered.
+  PipelineQueue<size_t> free_buffer_sets;
+  PipelineQueue<size_t> gathered;
+  PipelineQueue<size_t> forwarded;
+  for (size_t s = 0; s < kPipelineBufferSets; ++s) {
+    free_buffer_sets.Push(s);
+  }
+
+  std::shared_ptr<std::promise<void>> gather_done =
+      std::make_shared<std::promise<void>>();
+  std::shared_ptr<std::promise<void>> scatter_done =
+      std::make_shared<std::promise<void>>();
+  std::future<void> gather_future = gather_done->get_future();
+  std::future<void> scatter_future = scatter_done->get_future();
+
+  pipeline_pool_->Enqueue([this, batches, &free_buffer_sets, &gathered,
+                           gather_done] {
+    ApplyHelperThreadSettings();
+    for (size_t k = 0; k < batches->size(); ++k) {
+      MicroBatch& batch = (*batches)[k];
+      free_buffer_sets.Pop(&batch.buffer_set);
+      try {
+        GatherBatch(&batch);
+      }
+      catch (const std::exception& ex) {
+        FailBatch(&batch, "gather", ex);
+      }
+      gathered.Push(k);
+    }
+    gathered.Close();
+    gather_done->set_value();
+  });
+  pipeline_pool_->Enqueue([this, batches, exec_start_ns, &free_buffer_sets,
+                           &forwarded, scatter_done] {
+    ApplyHelperThreadSettings();
+    size_t k;
+    while (forwarded.Pop(&k)) {
+      MicroBatch& batch = (*batches)[k];
+      if (!batch.failed) {
+        try {
+          ScatterBatch(&batch);
+        }
+        catch (const std::exception& ex) {
+          FailBatch(&batch, "scatter", ex);
+        }
+      }
+      free_buffer_sets.Push(batch.buffer_set);
+
+      uint64_t exec_end_ns = 0;
+      SET_TIMESTAMP(exec_end_ns);
+      CompleteRequests(
+          batch.requests.data(), batch.requests.size(), &batch.responses,
+          exec_start_ns, batch.compute_start_ns, batch.compute_end_ns,
+          exec_end_ns);
+    }
+    scatter_done->set_value();
+  });
+
+  // A micro-batch that fails in a stage still goes through the queues,
+  // so that the later stages release its requests and buffers, and
+  // every stage closes its queue and signals that it is done.
+  size_t k;
+  while (gathered.Pop(&k)) {
+    MicroBatch& batch = (*batches)[k];
+    if (!batch.failed) {
+      try {
+        ForwardBatch(&batch);
+      }
+      catch (const std::exception& ex) {
+        SET_TIMESTAMP(batch.compute_end_ns);
+        FailBatch(&batch, "forward", ex);
+      }
+    } else {
+      SET_TIMESTAMP(batch.compute_start_ns);
+      batch.compute_end_ns = batch.compute_start_ns;
+    }
+    forwarded.Push(k);
+  }
+  forwarded.Close();
+
+  // The queues live on this stack so both stages must be done with
+  // them before returning.
+  gather_future.wait();
+  scatter_future.wait();
+}
 
+void
+ModelInstanceState::FailBatch(
+    MicroBatch* batch, const std::string& stage, const std::exception& ex)
+{
+  batch->failed = true;
+  batch->input_tensors.clear();
+  batch->output_tensors.clear();
+  SendErrorForResponses(
+      &batch->responses, batch->requests.size(),
+      TRITONSERVER_ErrorNew(
+          TRITONSERVER_ERROR_INTERNAL,
+          (std::string("failed to ") + stage + " micro-batch of '" + Name() +
+           "': " + ex.what())
+              .c_str()));
+}
+
+void
+ModelInstanceState::CompleteRequests(
+    TRITONBACKEND_Request** requests, const uint32_t request_count,
+    std::vector<TRITONBACKEND_Response*>* responses,
+    const uint64_t exec_start_ns, const uint64_t compute_start_ns,
+    const uint64_t compute_end_ns, const uint64_t exec_end_ns)
+{
   // Send all the responses that haven't already been sent because of
   // an earlier error. Note that the responses are not set to nullptr
   // here as we need that indication below to determine if the request
   // we successful or not.
   /* 发送response，把推理结果发送给Triton */
-  for (auto& response : responses) {
+  for (auto& response : *responses) {
     if (response != nullptr) {
       LOG_IF_ERROR(
           TRITONBACKEND_ResponseSend(
@@ -752,161 +3750,680 @@ ModelInstanceState::ProcessRequests(
     LOG_IF_ERROR(
         TRITONBACKEND_ModelInstanceReportStatistics(
             TritonModelInstance(), request,
-            (responses[r] != nullptr) /* success */, exec_start_ns,
+            ((*responses)[r] != nullptr) /* success */, exec_start_ns,
             compute_start_ns, compute_end_ns, exec_end_ns),
         "failed reporting request statistics");
 
-    /* 释放每个request对象 */
-    LOG_IF_ERROR(
-        TRITONBACKEND_RequestRelease(request, TRITONSERVER_REQUEST_RELEASE_ALL),
-        "failed releasing request");
+    /* 释放每个request对象 */
+    LOG_IF_ERROR(
+        TRITONBACKEND_RequestRelease(request, TRITONSERVER_REQUEST_RELEASE_ALL),
+        "failed releasing request");
+  }
+}
+
+void
+ModelInstanceState::Execute(
+    torch::jit::Module* model,
+    std::vector<TRITONBACKEND_Response*>* responses,
+    const uint32_t response_count, const size_t batch_size,
+    std::vector<torch::jit::IValue>* input_tensors,
+    std::vector<torch::Tensor>* output_tensors)
+{
+  torch::jit::IValue model_outputs_;
+
+  try {
+    torch::NoGradGuard no_grad;
+    ScopedIntraOpThreads intra_op_threads(IntraOpThreadsForBatch(batch_size));
+    /* PyTorch执行推理 */
+    model_outputs_ = model->forward(*input_tensors);
+    if (model_outputs_.isTuple()) {
+      /* 将模型输出tensor收集起来 */
+      auto model_outputs_tuple = model_outputs_.toTuple();
+      for (auto& m_op : model_outputs_tuple->elements()) {
+        output_tensors->push_back(m_op.toTensor());
+      }
+    } else {
+      auto model_output_tensor = model_outputs_.toTensor();
+      output_tensors->push_back(model_output_tensor);
+    }
+  }
+  catch (std::exception& ex) {
+    /* 如果模型前向失败，则对每个response都发送失败response */
+    SendErrorForResponses(
+        responses, response_count,
+        TRITONSERVER_ErrorNew(
+            TRITONSERVER_ERROR_INTERNAL,
+            ("PyTorch execute failure: " + std::string(ex.what())).c_str()));
+  }
+}
+
+void
+ModelInstanceState::SetInputTensors(
+    size_t total_batch_size, const size_t padded_batch_size,
+    BufferArena* arena, const size_t buffer_set,
+    TRITONBACKEND_Request** requests,
+    const uint32_t request_count,
+    std::vector<TRITONBACKEND_Response*>* responses,
+    BackendInputCollector* collector,
+    std::vector<torch::jit::IValue>* input_tensors,
+    std::vector<int64_t>* ragged_lengths, int64_t* padded_length,
+    CopyStats* gather_stats, bool* cuda_copy)
+{
+  const int max_batch_size = model_state_->MaxBatchSize();
+
+  // All requests must have equally-sized input tensors so use any
+  // request as the representative for the input tensors.
+  *input_tensors = default_args_;
+  /* 对每个input依次进行处理 */
+  for (size_t slot = 0; slot < input_bindings_.size(); ++slot) {
+    const auto& binding = input_bindings_[slot];
+    const size_t arena_slot = buffer_set * input_bindings_.size() + slot;
+    const char* input_name = binding.name.c_str();
+    if (binding.optional) {
+      // The forward() argument is shared by the batch, so it keeps its
+      // default value only when every request omits the input.
+      uint32_t present_count = 0;
+      for (uint32_t r = 0; r < request_count; ++r) {
+        TRITONBACKEND_Input* request_input;
+        TRITONSERVER_Error* err =
+            TRITONBACKEND_RequestInput(requests[r], input_name, &request_input);
+        if (err == nullptr) {
+          ++present_count;
+        } else {
+          TRITONSERVER_ErrorDelete(err);
+        }
+      }
+      if (present_count == 0) {
+        continue;
+      }
+      if (present_count != request_count) {
+        RESPOND_ALL_AND_RETURN_IF_ERROR(
+            responses, request_count,
+            TRITONSERVER_ErrorNew(
+                TRITONSERVER_ERROR_INVALID_ARG,
+                (std::string("optional input '") + input_name +
+                 "' is sent by " + std::to_string(present_count) + " of " +
+                 std::to_string(request_count) +
+                 " requests of the batch, it must be sent by all or none "
+                 "of them")
+                    .c_str()));
+      }
+    }
+    TRITONBACKEND_Input* input;
+    /* 获取request中的目标input对象 */
+    TRITONSERVER_Error* err =
+        TRITONBACKEND_RequestInput(requests[0], input_name, &input);
+    RESPOND_ALL_AND_RETURN_IF_ERROR(responses, request_count, err);
+
+    TRITONSERVER_DataType input_datatype;
+    const int64_t* input_shape;
+    uint32_t input_dims_count;
+    uint32_t input_buffer_count;
+    /* 获取input的相关属性，包括shape, 类型等 */
+    RESPOND_ALL_AND_RETURN_IF_ERROR(
+        responses, request_count,
+        TRITONBACKEND_InputProperties(
+            input, nullptr, &input_datatype, &input_shape, &input_dims_count,
+            nullptr, &input_buffer_count));
+
+    // The shape for the entire input patch, [total_batch_size, ...]
+    // or [total length, ...] for a ragged input.
+    std::vector<int64_t> batchn_shape;
+    if (binding.ragged) {
+      std::vector<int64_t> lengths;
+      RESPOND_ALL_AND_RETURN_IF_ERROR(
+          responses, request_count,
+          RaggedInputShape(
+              input_name, requests, request_count, &batchn_shape, &lengths));
+      if (ragged_lengths->empty()) {
+        *ragged_lengths = lengths;
+      } else if (*ragged_lengths != lengths) {
+        RESPOND_ALL_AND_RETURN_IF_ERROR(
+            responses, request_count,
+            TRITONSERVER_ErrorNew(
+                TRITONSERVER_ERROR_INVALID_ARG,
+                (std::string("ragged input '") + input_name +
+                 "' has request lengths that differ from other ragged "
+                 "inputs")
+                    .c_str()));
+      }
+
+      if (model_state_->RaggedBatchingMode() ==
+          ModelState::RaggedBatching::PAD) {
+        // [padded batch size, longest length rounded up to its bucket,
+        // ...]
+        *padded_length = RoundUpToBucket(
+            sequence_buckets_,
+            *std::max_element(lengths.begin(), lengths.end()));
+        std::vector<int64_t> padded_shape(batchn_shape);
+        padded_shape[0] = *padded_length;
+        padded_shape.insert(padded_shape.begin(), padded_batch_size);
+        size_t row_byte_size = TRITONSERVER_DataTypeByteSize(input_datatype);
+        for (size_t d = 1; d < batchn_shape.size(); ++d) {
+          row_byte_size *= batchn_shape[d];
+        }
+
+        const auto torch_dtype = ConvertDataTypeToTorchType(input_datatype);
+        torch::Tensor input_tensor;
+        char* padded_buffer;
+        if (device_.is_cpu()) {
+          TRITONSERVER_MemoryType memory_type;
+          int64_t memory_type_id;
+          RESPOND_ALL_AND_RETURN_IF_ERROR(
+              responses, request_count,
+              arena->Acquire(
+                  arena_slot, GetByteSize(input_datatype, padded_shape),
+                  &padded_buffer, &memory_type, &memory_type_id));
+          input_tensor = torch::from_blob(
+              padded_buffer, padded_shape,
+              torch::TensorOptions(torch_dtype.second));
+        } else {
+          // Padded on the host, then copied to the device.
+          input_tensor = torch::empty(
+              padded_shape, torch::TensorOptions(torch_dtype.second));
+          padded_buffer = static_cast<char*>(input_tensor.data_ptr());
+        }
+
+        RESPOND_ALL_AND_RETURN_IF_ERROR(
+            responses, request_count,
+            GatherPaddedInput(
+                input_name, requests, request_count, lengths, *padded_length,
+                padded_batch_size, row_byte_size, padded_buffer,
+                gather_stats));
+        (*input_tensors)[binding.arg_index] =
+            device_.is_cpu() ? input_tensor : input_tensor.to(device_);
+        continue;
+      }
+    } else {
+      batchn_shape.assign(input_shape, input_shape + input_dims_count);
+      /* 把batch_size那一维设置成所有request总的batch_size */
+      if (max_batch_size != 0) {
+        batchn_shape[0] = total_batch_size;
+      }
+    }
+
+    // The input must be in contiguous CPU/GPU memory.
+    const int64_t batchn_byte_size = GetByteSize(input_datatype, batchn_shape);
+
+    // A batch bucket adds zero-filled rows after those of the requests.
+    std::vector<int64_t> padded_shape(batchn_shape);
+    if ((max_batch_size != 0) && !binding.ragged) {
+      padded_shape[0] = padded_batch_size;
+    }
+    const int64_t padded_byte_size = GetByteSize(input_datatype, padded_shape);
+
+    // A converted input of a CPU instance is converted while it is
+    // gathered. Otherwise it is gathered as sent and converted once
+    // copied, see GatherBatch().
+    if ((binding.ingress != nullptr) && device_.is_cpu()) {
+      torch::Tensor input_tensor;
+      RESPOND_ALL_AND_RETURN_IF_ERROR(
+          responses, request_count,
+          GatherConvertedInput(
+              input_name, *binding.ingress, input_datatype, requests,
+              request_count, padded_shape, GetElementCount(batchn_shape),
+              arena, arena_slot, &input_tensor, gather_stats));
+      if (input_tensor.defined()) {
+        (*input_tensors)[binding.arg_index] = input_tensor;
+        continue;
+      }
+    }
+
+    // A batch of a single request whose input already is one buffer
+    // the model can read is used in place, skipping the allocation and
+    // copy below.
+    char* input_buffer = nullptr;
+    if ((request_count == 1) && (input_buffer_count == 1) &&
+        (padded_byte_size == batchn_byte_size)) {
+      input_buffer = DirectInputBuffer(input, input_datatype, batchn_byte_size);
+    }
+
+    if (input_buffer == nullptr) {
+      /* 为input tensor在特定设备上获取内存。这里相当于把所有request中的目标input都聚合在一起进行内存分配 */
+      TRITONSERVER_MemoryType memory_type;
+      int64_t memory_type_id;
+      RESPOND_ALL_AND_RETURN_IF_ERROR(
+          responses, request_count,
+          arena->Acquire(
+              arena_slot, padded_byte_size, &input_buffer, &memory_type,
+              &memory_type_id));
+
+      /* 将所有request中的目标input聚合在一起，并将输入数据拷贝到刚才申请的input tensor buffer中 */
+      const bool gathered =
+          (memory_type != TRITONSERVER_MEMORY_GPU) &&
+          GatherInput(
+              input_name, requests, request_count, input_buffer,
+              batchn_byte_size, gather_stats);
+      if (!gathered) {
+        collector->ProcessTensor(
+            input_name, input_buffer, batchn_byte_size, memory_type,
+            memory_type_id);
+      }
+
+      if (padded_byte_size > batchn_byte_size) {
+        if (memory_type != TRITONSERVER_MEMORY_GPU) {
+          std::memset(
+              input_buffer + batchn_byte_size, 0,
+              padded_byte_size - batchn_byte_size);
+        } else {
+#ifdef TRITON_ENABLE_GPU
+          cudaMemsetAsync(
+              input_buffer + batchn_byte_size, 0,
+              padded_byte_size - batchn_byte_size, stream_);
+          *cuda_copy = true;
+#endif  // TRITON_ENABLE_GPU
+        }
+      }
+    }
+
+    // Create Torch tenor
+    const auto torch_dtype = ConvertDataTypeToTorchType(input_datatype);
+    torch::TensorOptions options{torch_dtype.second};
+    auto updated_options = device_.is_cuda()
+                               ? options.device(torch::kCUDA, device_.index())
+                               : options.device(torch::kCPU);
+
+    /* 从input_buffer中的输入数据创建PyTorch的输入tensors */
+    torch::Tensor input_tensor =
+        torch::from_blob(input_buffer, padded_shape, updated_options);
+    (*input_tensors)[binding.arg_index] = input_tensor;
+  }
+
+  // The offsets have one more entry than requests so that request 'i'
+  // spans [offsets[i], offsets[i + 1]).
+  if ((ragged_offsets_arg_index_ >= 0) && !ragged_lengths->empty()) {
+    std::vector<int64_t> offsets(1, 0);
+    for (const int64_t length : *ragged_lengths) {
+      offsets.push_back(offsets.back() + length);
+    }
+    (*input_tensors)[ragged_offsets_arg_index_] =
+        torch::tensor(offsets, torch::TensorOptions(torch::kInt64))
+            .to(device_);
+  }
+
+  // The mask is true for the positions of each request that are not
+  // padding. The rows added for a batch bucket are all padding.
+  if ((padding_mask_arg_index_ >= 0) && !ragged_lengths->empty()) {
+    std::vector<int64_t> row_lengths(*ragged_lengths);
+    row_lengths.resize(padded_batch_size, 0);
+    const torch::Tensor lengths =
+        torch::tensor(row_lengths, torch::TensorOptions(torch::kInt64))
+            .to(device_);
+    (*input_tensors)[padding_mask_arg_index_] =
+        torch::arange(
+            *padded_length,
+            torch::TensorOptions(torch::kInt64).device(device_))
+            .unsqueeze(0)
+            .lt(lengths.unsqueeze(1));
+  }
+
+  // Finalize...
+  *cuda_copy |= collector->Finalize();
+}
+
+TRITONSERVER_Error*
+ModelInstanceState::GatherPaddedInput(
+    const char* input_name, TRITONBACKEND_Request** requests,
+    const uint32_t request_count, const std::vector<int64_t>& lengths,
+    const int64_t max_length, const size_t row_count,
+    const size_t row_byte_size, char* buffer, CopyStats* stats)
+{
+  const size_t padded_byte_size = max_length * row_byte_size;
+  std::vector<CopySpan> spans;
+  for (uint32_t r = 0; r < request_count; ++r) {
+    char* dst = buffer + r * padded_byte_size;
+    const size_t byte_size = lengths[r] * row_byte_size;
+
+    TRITONBACKEND_Input* input;
+    RETURN_IF_ERROR(
+        TRITONBACKEND_RequestInput(requests[r], input_name, &input));
+    uint32_t buffer_count;
+    RETURN_IF_ERROR(TRITONBACKEND_InputProperties(
+        input, nullptr, nullptr, nullptr, nullptr, nullptr, &buffer_count));
+
+    size_t offset = 0;
+    for (uint32_t b = 0; b < buffer_count; ++b) {
+      const void* src;
+      uint64_t src_byte_size;
+      TRITONSERVER_MemoryType memory_type = TRITONSERVER_MEMORY_CPU;
+      int64_t memory_type_id = 0;
+      RETURN_IF_ERROR(TRITONBACKEND_InputBuffer(
+          input, b, &src, &src_byte_size, &memory_type, &memory_type_id));
+      if (memory_type == TRITONSERVER_MEMORY_GPU) {
+        return TRITONSERVER_ErrorNew(
+            TRITONSERVER_ERROR_UNSUPPORTED,
+            (std::string("padded input '") + input_name +
+             "' must be provided in host memory")
+                .c_str());
+      }
+      if (offset + src_byte_size > byte_size) {
+        break;
+      }
+      spans.push_back({dst + offset, static_cast<const char*>(src),
+                       static_cast<size_t>(src_byte_size)});
+      offset += src_byte_size;
+    }
+    if (offset != byte_size) {
+      return TRITONSERVER_ErrorNew(
+          TRITONSERVER_ERROR_INVALID_ARG,
+          (std::string("unexpected size of input '") + input_name +
+           "', expecting " + std::to_string(byte_size) + " bytes")
+              .c_str());
+    }
+
+    std::memset(dst + byte_size, 0, padded_byte_size - byte_size);
+  }
+  if (row_count > request_count) {
+    std::memset(
+        buffer + request_count * padded_byte_size, 0,
+        (row_count - request_count) * padded_byte_size);
+  }
+
+  copy_engine_.Copy(spans, stats);
+  return nullptr;  // success
+}
+
+TRITONSERVER_Error*
+ModelInstanceState::RaggedInputShape(
+    const char* input_name, TRITONBACKEND_Request** requests,
+    const uint32_t request_count, std::vector<int64_t>* batchn_shape,
+    std::vector<int64_t>* lengths)
+{
+  batchn_shape->clear();
+  lengths->clear();
+  for (uint32_t r = 0; r < request_count; ++r) {
+    TRITONBACKEND_Input* input;
+    RETURN_IF_ERROR(
+        TRITONBACKEND_RequestInput(requests[r], input_name, &input));
+    const int64_t* shape;
+    uint32_t dims_count;
+    RETURN_IF_ERROR(TRITONBACKEND_InputProperties(
+        input, nullptr, nullptr, &shape, &dims_count, nullptr, nullptr));
+
+    if ((dims_count < 2) || (shape[0] != 1)) {
+      return TRITONSERVER_ErrorNew(
+          TRITONSERVER_ERROR_INVALID_ARG,
+          (std::string("ragged input '") + input_name +
+           "' must have batch size 1 and at least one non-batch dimension")
+              .c_str());
+    }
+
+    if (r == 0) {
+      batchn_shape->assign(shape + 1, shape + dims_count);
+      (*batchn_shape)[0] = 0;
+    } else if (
+        (batchn_shape->size() != dims_count - 1) ||
+        !std::equal(shape + 2, shape + dims_count, batchn_shape->begin() + 1)) {
+      return TRITONSERVER_ErrorNew(
+          TRITONSERVER_ERROR_INVALID_ARG,
+          (std::string("requests of ragged input '") + input_name +
+           "' differ in more than the first non-batch dimension")
+              .c_str());
+    }
+
+    (*batchn_shape)[0] += shape[1];
+    lengths->push_back(shape[1]);
+  }
+
+  return nullptr;  // success
+}
+
+bool
+ModelInstanceState::GatherInput(
+    const char* input_name, TRITONBACKEND_Request** requests,
+    const uint32_t request_count, char* buffer, const size_t byte_size,
+    CopyStats* stats)
+{
+  std::vector<CopySpan> spans;
+  size_t offset = 0;
+  for (uint32_t r = 0; r < request_count; ++r) {
+    TRITONBACKEND_Input* input;
+    uint32_t buffer_count = 0;
+    TRITONSERVER_Error* err =
+        TRITONBACKEND_RequestInput(requests[r], input_name, &input);
+    if (err == nullptr) {
+      err = TRITONBACKEND_InputProperties(
+          input, nullptr, nullptr, nullptr, nullptr, nullptr, &buffer_count);
+    }
+    for (uint32_t b = 0; (err == nullptr) && (b < buffer_count); ++b) {
+      const void* src;
+      uint64_t src_byte_size;
+      TRITONSERVER_MemoryType memory_type = TRITONSERVER_MEMORY_CPU;
+      int64_t memory_type_id = 0;
+      err = TRITONBACKEND_InputBuffer(
+          input, b, &src, &src_byte_size, &memory_type, &memory_type_id);
+      if (err == nullptr) {
+        if ((memory_type == TRITONSERVER_MEMORY_GPU) ||
+            (offset + src_byte_size > byte_size)) {
+          return false;
+        }
+        spans.push_back(
+            {buffer + offset, static_cast<const char*>(src), src_byte_size});
+        offset += src_byte_size;
+      }
+    }
+
+    // The input collector reports the error to the failing request.
+    if (err != nullptr) {
+      TRITONSERVER_ErrorDelete(err);
+      return false;
+    }
+  }
+
+  if (offset != byte_size) {
+    return false;
   }
 
-  // Report the entire batch statistics.
-  LOG_IF_ERROR(
-      TRITONBACKEND_ModelInstanceReportBatchStatistics(
-          TritonModelInstance(), total_batch_size, exec_start_ns,
-          compute_start_ns, compute_end_ns, exec_end_ns),
-      "failed reporting batch request statistics");
+  copy_engine_.Copy(spans, stats);
+  return true;
 }
 
-void
-ModelInstanceState::Execute(
-    std::vector<TRITONBACKEND_Response*>* responses,
-    const uint32_t response_count,
-    std::vector<torch::jit::IValue>* input_tensors,
-    std::vector<torch::Tensor>* output_tensors)
+TRITONSERVER_Error*
+ModelInstanceState::GatherConvertedInput(
+    const char* input_name, const ModelState::IngressConversion& conversion,
+    const TRITONSERVER_DataType datatype, TRITONBACKEND_Request** requests,
+    const uint32_t request_count, const std::vector<int64_t>& padded_shape,
+    const int64_t element_count, BufferArena* arena, const size_t arena_slot,
+    torch::Tensor* tensor, CopyStats* stats)
 {
-  torch::jit::IValue model_outputs_;
+  const auto wire_type = ConvertDataTypeToTorchType(datatype);
+  const size_t element_size = TRITONSERVER_DataTypeByteSize(datatype);
+  if (!wire_type.first || (element_size == 0)) {
+    return nullptr;  // success
+  }
 
-  try {
-    torch::NoGradGuard no_grad;
-    /* PyTorch执行推理 */
-    model_outputs_ = torch_model_->forward(*input_tensors);
-    if (model_outputs_.isTuple()) {
-      /* 将模型输出tensor收集起来 */
-      auto model_outputs_tuple = model_outputs_.toTuple();
-      for (auto& m_op : model_outputs_tuple->elements()) {
-        output_tensors->push_back(m_op.toTensor());
+  // The buffers of all requests are looked up before anything is
+  // written so that the input collector can take over.
+  std::vector<std::pair<const void*, int64_t>> srcs;
+  int64_t total_count = 0;
+  for (uint32_t r = 0; r < request_count; ++r) {
+    TRITONBACKEND_Input* input;
+    uint32_t buffer_count = 0;
+    TRITONSERVER_Error* err =
+        TRITONBACKEND_RequestInput(requests[r], input_name, &input);
+    if (err == nullptr) {
+      err = TRITONBACKEND_InputProperties(
+          input, nullptr, nullptr, nullptr, nullptr, nullptr, &buffer_count);
+    }
+    for (uint32_t b = 0; (err == nullptr) && (b < buffer_count); ++b) {
+      const void* src;
+      uint64_t src_byte_size;
+      TRITONSERVER_MemoryType memory_type = TRITONSERVER_MEMORY_CPU;
+      int64_t memory_type_id = 0;
+      err = TRITONBACKEND_InputBuffer(
+          input, b, &src, &src_byte_size, &memory_type, &memory_type_id);
+      if (err == nullptr) {
+        if ((memory_type == TRITONSERVER_MEMORY_GPU) ||
+            ((src_byte_size % element_size) != 0)) {
+          return nullptr;  // success
+        }
+        srcs.emplace_back(src, src_byte_size / element_size);
+        total_count += src_byte_size / element_size;
       }
-    } else {
-      auto model_output_tensor = model_outputs_.toTensor();
-      output_tensors->push_back(model_output_tensor);
+    }
+
+    // The input collector reports the error to the failing request.
+    if (err != nullptr) {
+      TRITONSERVER_ErrorDelete(err);
+      return nullptr;  // success
     }
   }
-  catch (std::exception& ex) {
-    /* 如果模型前向失败，则对每个response都发送失败response */
-    SendErrorForResponses(
-        responses, response_count,
-        TRITONSERVER_ErrorNew(
-            TRITONSERVER_ERROR_INTERNAL,
-            ("PyTorch execute failure: " + std::string(ex.what())).c_str()));
+  if (total_count != element_count) {
+    return nullptr;  // success
+  }
+
+  const size_t converted_size = c10::elementSize(conversion.dtype);
+  const int64_t padded_count = GetElementCount(padded_shape);
+  char* buffer;
+  TRITONSERVER_MemoryType memory_type;
+  int64_t memory_type_id;
+  RETURN_IF_ERROR(arena->Acquire(
+      arena_slot, padded_count * converted_size, &buffer, &memory_type,
+      &memory_type_id));
+
+  // Each buffer is converted, scaled and offset by one libtorch op
+  // straight into the batch.
+  const auto start = std::chrono::steady_clock::now();
+  try {
+    int64_t offset = 0;
+    for (const auto& src : srcs) {
+      torch::Tensor dst = torch::from_blob(
+          buffer + offset * converted_size, {src.second},
+          torch::TensorOptions(conversion.dtype));
+      ConvertIngress(
+          conversion,
+          torch::from_blob(
+              const_cast<void*>(src.first), {src.second},
+              torch::TensorOptions(wire_type.second)),
+          &dst);
+      offset += src.second;
+    }
+  }
+  catch (const std::exception& ex) {
+    return TRITONSERVER_ErrorNew(
+        TRITONSERVER_ERROR_INTERNAL,
+        (std::string("failed to convert input '") + input_name +
+         "': " + ex.what())
+            .c_str());
   }
+  std::memset(
+      buffer + element_count * converted_size, 0,
+      (padded_count - element_count) * converted_size);
+  stats->bytes += element_count * element_size;
+  stats->copy_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        std::chrono::steady_clock::now() - start)
+                        .count();
+
+  *tensor = torch::from_blob(
+      buffer, padded_shape, torch::TensorOptions(conversion.dtype));
+  return nullptr;  // success
 }
 
 void
-ModelInstanceState::SetInputTensors(
-    size_t total_batch_size, TRITONBACKEND_Request** requests,
-    const uint32_t request_count,
-    std::vector<TRITONBACKEND_Response*>* responses,
-    BackendInputCollector* collector, std::vector<const char*>* input_names,
-    std::vector<torch::jit::IValue>* input_tensors,
-    std::vector<BackendMemory*>* input_memories, bool* cuda_copy)
+ModelInstanceState::ConvertIngress(
+    const ModelState::IngressConversion& conversion,
+    const torch::Tensor& src, torch::Tensor* dst)
 {
-  const int max_batch_size = model_state_->MaxBatchSize();
-
-  // All requests must have equally-sized input tensors so use any
-  // request as the representative for the input tensors.
-  uint32_t input_count;
-  /* 首先用任意一个request来获取每个request中input tensor的数量 */
-  RESPOND_ALL_AND_RETURN_IF_ERROR(
-      responses, request_count,
-      TRITONBACKEND_RequestInputCount(requests[0], &input_count));
-  input_tensors->resize(input_count);
-  /* 对每个input依次进行处理 */
-  for (uint32_t input_idx = 0; input_idx < input_count; input_idx++) {
-    TRITONBACKEND_Input* input;
-    /* 获取request中的目标input对象 */
-    RESPOND_ALL_AND_RETURN_IF_ERROR(
-        responses, request_count,
-        TRITONBACKEND_RequestInputByIndex(requests[0], input_idx, &input));
-
-    const char* input_name;
-    TRITONSERVER_DataType input_datatype;
-    const int64_t* input_shape;
-    uint32_t input_dims_count;
-    /* 获取input的相关属性，包括shape, 类型等 */
-    RESPOND_ALL_AND_RETURN_IF_ERROR(
-        responses, request_count,
-        TRITONBACKEND_InputProperties(
-            input, &input_name, &input_datatype, &input_shape,
-            &input_dims_count, nullptr, nullptr));
-
-    input_names->emplace_back(input_name);
+  if ((conversion.scale == 1) && (conversion.offset == 0)) {
+    dst->copy_(src);
+    return;
+  }
 
-    // The shape for the entire input patch, [total_batch_size, ...]
-    std::vector<int64_t> batchn_shape(
-        input_shape, input_shape + input_dims_count);
-    /* 把batch_size那一维设置成所有request总的batch_size */
-    if (max_batch_size != 0) {
-      batchn_shape[0] = total_batch_size;
-    }
+  // 'dst' = 'offset' + 'scale' * 'src', with 'src' converted to the
+  // datatype of 'dst' by the same kernel.
+  at::add_out(
+      *dst,
+      torch::scalar_tensor(
+          conversion.offset, torch::TensorOptions(dst->scalar_type())),
+      src, conversion.scale);
+}
 
-    // The input must be in contiguous CPU/GPU memory.
-    const int64_t batchn_byte_size = GetByteSize(input_datatype, batchn_shape);
+char*
+ModelInstanceState::DirectInputBuffer(
+    TRITONBACKEND_Input* input, const TRITONSERVER_DataType datatype,
+    const int64_t byte_size)
+{
+  const void* buffer;
+  uint64_t buffer_byte_size;
+  TRITONSERVER_MemoryType memory_type =
+      device_.is_cpu() ? TRITONSERVER_MEMORY_CPU : TRITONSERVER_MEMORY_GPU;
+  int64_t memory_type_id = device_.is_cpu() ? 0 : device_.index();
+  TRITONSERVER_Error* err = TRITONBACKEND_InputBuffer(
+      input, 0, &buffer, &buffer_byte_size, &memory_type, &memory_type_id);
+  if (err != nullptr) {
+    TRITONSERVER_ErrorDelete(err);
+    return nullptr;
+  }
 
-    std::vector<BackendMemory::AllocationType> alloc_perference;
-    if (device_.is_cpu()) {
-      alloc_perference = {BackendMemory::AllocationType::CPU};
-    } else {
-      alloc_perference = {BackendMemory::AllocationType::GPU_POOL,
-                          BackendMemory::AllocationType::GPU};
+  if (static_cast<int64_t>(buffer_byte_size) != byte_size) {
+    return nullptr;
+  }
+  if (device_.is_cpu()) {
+    if (memory_type == TRITONSERVER_MEMORY_GPU) {
+      return nullptr;
     }
+  } else if (
+      (memory_type != TRITONSERVER_MEMORY_GPU) ||
+      (memory_type_id != device_.index())) {
+    return nullptr;
+  }
 
-    /* 为input tensor在特定设备上分配内存。这里相当于把所有request中的目标input都聚合在一起进行内存分配 */
-    BackendMemory* input_memory;
-    RESPOND_ALL_AND_RETURN_IF_ERROR(
-        responses, request_count,
-        BackendMemory::Create(
-            model_state_->TritonMemoryManager(), alloc_perference,
-            device_.is_cpu() ? 0 : device_.index(), batchn_byte_size,
-            &input_memory));
-    input_memories->push_back(input_memory);
-
-    /* 创建input buffer */
-    TRITONSERVER_MemoryType memory_type = input_memory->MemoryType();
-    int64_t memory_type_id = input_memory->MemoryTypeId();
-    char* input_buffer = input_memory->MemoryPtr();
-
-    /* 将所有request中的目标input聚合在一起，并将输入数据拷贝到刚才申请的input tensor buffer中 */
-    collector->ProcessTensor(
-        input_name, input_buffer, batchn_byte_size, memory_type,
-        memory_type_id);
-
-    // Create Torch tenor
-    const auto torch_dtype = ConvertDataTypeToTorchType(input_datatype);
-    torch::TensorOptions options{torch_dtype.second};
-    auto updated_options = device_.is_cuda()
-                               ? options.device(torch::kCUDA, device_.index())
-                               : options.device(torch::kCPU);
-
-    /* 从input_buffer中的输入数据创建PyTorch的输入tensors */
-    torch::Tensor input_tensor =
-        torch::from_blob(input_buffer, batchn_shape, updated_options);
-    (*input_tensors)[input_index_map_[input_name]] = input_tensor;
+  // Kernels may assume that tensor data is aligned to its element size.
+  const uint32_t element_size = TRITONSERVER_DataTypeByteSize(datatype);
+  if ((element_size > 1) &&
+      ((reinterpret_cast<uintptr_t>(buffer) % element_size) != 0)) {
+    return nullptr;
   }
 
-  // Finalize...
-  *cuda_copy |= collector->Finalize();
+  // The buffer stays valid until the request is released, which happens
+  // after the batch has executed. Like any input it must not be
+  // modified in place by the model.
+  return const_cast<char*>(reinterpret_cast<const char*>(buffer));
 }
 
 void
 ModelInstanceState::ReadOutputTensors(
-    size_t total_batch_size, const std::vector<const char*>& output_names,
+    size_t total_batch_size, const size_t padded_batch_size,
+    const int64_t padded_length,
     const std::vector<torch::Tensor>& output_tensors,
     TRITONBACKEND_Request** requests, const uint32_t request_count,
-    std::vector<TRITONBACKEND_Response*>* responses)
+    const std::vector<int64_t>& request_batch_sizes,
+    const std::vector<int64_t>& ragged_lengths,
+    std::vector<TRITONBACKEND_Response*>* responses,
+    CopyStats* scatter_stats, size_t* skipped_output_count)
 {
+  const int max_batch_size = model_state_->MaxBatchSize();
+
+  // The outputs each request asks for, by binding, matched once per
+  // execution. Outputs that no request of the batch asked for are
+  // neither made contiguous, checked nor scattered.
+  std::vector<std::vector<bool>> requested(
+      output_bindings_.size(), std::vector<bool>(request_count, false));
+  std::vector<bool> any_requested(output_bindings_.size(), false);
+  for (uint32_t r = 0; r < request_count; ++r) {
+    TRITONBACKEND_Response** response = &(*responses)[r];
+    if (*response == nullptr) {
+      continue;
+    }
+    uint32_t output_count = 0;
+    RESPOND_AND_SET_NULL_IF_ERROR(
+        response, TRITONBACKEND_RequestOutputCount(requests[r], &output_count));
+    for (uint32_t i = 0; (*response != nullptr) && (i < output_count); ++i) {
+      const char* output_name;
+      RESPOND_AND_SET_NULL_IF_ERROR(
+          response,
+          TRITONBACKEND_RequestOutputName(requests[r], i, &output_name));
+      for (size_t b = 0; (*response != nullptr) && (b < requested.size());
+           ++b) {
+        if (output_bindings_[b].name == output_name) {
+          requested[b][r] = true;
+          any_requested[b] = true;
+          break;
+        }
+      }
+    }
+  }
+
   BackendOutputResponder responder(
       requests, request_count, responses, model_state_->MaxBatchSize(),
       model_state_->TritonMemoryManager(), model_state_->EnablePinnedInput(),
@@ -914,15 +4431,85 @@ ModelInstanceState::ReadOutputTensors(
 
   bool cuda_copy = false;
   std::vector<std::vector<char>> string_buffers;
+
+  // Host outputs are scattered by the copy engine once the responses of
+  // all outputs are created, the flattened tensors must stay alive
+  // until then. Host outputs that are not contiguous, such as permuted
+  // or sliced views, are scattered from their strides by libtorch
+  // instead of first being copied into a contiguous tensor.
+  std::vector<CopySpan> scatter_spans;
+  std::vector<StridedCopy> strided_copies;
+  std::vector<torch::Tensor> scattered_tensors;
   /* 依次处理每个输出 */
-  for (size_t idx = 0; idx < output_names.size(); idx++) {
-    std::string name = output_names[idx];
-    int op_index = output_index_map_[name];
+  for (size_t b = 0; b < output_bindings_.size(); ++b) {
+    const auto& binding = output_bindings_[b];
+    const std::string& name = binding.name;
+    const int op_index = binding.output_index;
     torch::Tensor output_flat;
+    if (!any_requested[b]) {
+      ++*skipped_output_count;
+      continue;
+    }
+    if (binding.classification != nullptr) {
+      ScatterClassification(
+          name, *binding.classification, output_tensors[op_index],
+          requested[b], request_count, request_batch_sizes, responses);
+      continue;
+    }
+
+    // An output of a concatenated ragged batch that has no batch
+    // dimension is the concatenation of the request outputs along its
+    // first dimension. An output of a padded batch whose first dimension
+    // is variable-size is padded to the longest request, or its bucket,
+    // and is trimmed back to the length of each request. Rows added for
+    // a batch bucket are dropped.
+    const torch::Tensor& output_tensor = output_tensors[op_index];
+    const bool ragged_output =
+        (ragged_offsets_arg_index_ >= 0) && !ragged_lengths.empty() &&
+        (output_tensor.dim() == static_cast<int64_t>(binding.dims.size()));
+    const bool padded_output =
+        (model_state_->RaggedBatchingMode() ==
+         ModelState::RaggedBatching::PAD) &&
+        !ragged_lengths.empty() && !binding.dims.empty() &&
+        (binding.dims[0] < 0) && (output_tensor.dim() >= 2) &&
+        (output_tensor.size(0) ==
+         static_cast<int64_t>(padded_batch_size)) &&
+        (output_tensor.size(1) == padded_length);
 
     /* 获取当前的目标output tensor，并转换为连续且flattened的内存块 */
+    // An output converted on egress is converted on the device before
+    // the copy to the host. On the host it takes the strided path and
+    // the copy of each request's slice into its response buffer
+    // converts it, quantizing it to INT8 if needed.
+    const bool convert = (binding.egress_scale > 0);
+    if (convert && !output_tensor.is_floating_point()) {
+      RESPOND_ALL_AND_RETURN_IF_ERROR(
+          responses, request_count,
+          TRITONSERVER_ErrorNew(
+              TRITONSERVER_ERROR_INVALID_ARG,
+              (std::string("EGRESS_CONVERSION of output '") + name +
+               "' requires a floating-point result")
+                  .c_str()));
+    }
+    torch::Tensor output;
+    bool strided = false;
     try {
-      output_flat = output_tensors[op_index].contiguous().flatten();
+      output = output_tensor;
+      if (convert && !output.device().is_cpu()) {
+        output = (binding.dtype == TRITONSERVER_TYPE_INT8)
+                     ? QuantizeInt8(output, binding.egress_scale)
+                           .to(torch::kChar)
+                     : output.to(
+                           ConvertDataTypeToTorchType(binding.dtype).second);
+      }
+      if ((ragged_output || padded_output) && !device_.is_cpu()) {
+        output = output.cpu();
+      }
+      strided = output.device().is_cpu() &&
+                (!output.is_contiguous() ||
+                 (convert && (ConvertTorchTypeToDataType(
+                                  output.scalar_type()) != binding.dtype)));
+      output_flat = strided ? output : output.contiguous().flatten();
     }
     catch (std::exception& ex) {
       RESPOND_ALL_AND_RETURN_IF_ERROR(
@@ -933,10 +4520,17 @@ ModelInstanceState::ReadOutputTensors(
                   .c_str()));
     }
 
+    const double quantize_scale =
+        (strided && convert && (binding.dtype == TRITONSERVER_TYPE_INT8) &&
+         (output.scalar_type() != torch::kChar))
+            ? binding.egress_scale
+            : 0;
+
     // Verify output datatype matches datatype from model config
     TRITONSERVER_DataType output_dtype =
-        ConvertTorchTypeToDataType(output_flat.scalar_type());
-    TRITONSERVER_DataType config_datatype = output_dtype_map_[name];
+        convert ? binding.dtype
+                : ConvertTorchTypeToDataType(output.scalar_type());
+    TRITONSERVER_DataType config_datatype = binding.dtype;
     if (config_datatype != output_dtype) {
       RESPOND_ALL_AND_RETURN_IF_ERROR(
           responses, request_count,
@@ -961,11 +4555,139 @@ ModelInstanceState::ReadOutputTensors(
     }
 
     /* 对当前的output进行处理，从大output batch中提取相应输出数据生成对应request的response */
-    responder.ProcessTensor(
-        name, output_dtype, batchn_shape, output_buffer,
-        (device_.type() == torch::kCPU) ? TRITONSERVER_MEMORY_CPU
-                                        : TRITONSERVER_MEMORY_GPU,
-        (device_.type() == torch::kCPU) ? 0 : device_.index());
+    if (ragged_output) {
+      int64_t total_length = 0;
+      std::vector<std::vector<int64_t>> request_shapes;
+      for (const int64_t length : ragged_lengths) {
+        std::vector<int64_t> request_shape(batchn_shape);
+        request_shape[0] = length;
+        request_shape.insert(request_shape.begin(), 1);
+        request_shapes.push_back(request_shape);
+        total_length += length;
+      }
+      if (batchn_shape.empty() || (batchn_shape[0] != total_length)) {
+        RESPOND_ALL_AND_RETURN_IF_ERROR(
+            responses, request_count,
+            TRITONSERVER_ErrorNew(
+                TRITONSERVER_ERROR_INVALID_ARG,
+                (std::string("ragged output '") + name + "' has " +
+                 (batchn_shape.empty() ? std::string("no dimensions")
+                                       : std::to_string(batchn_shape[0]) +
+                                             " rows") +
+                 ", expecting the total request length " +
+                 std::to_string(total_length))
+                    .c_str()));
+      }
+
+      std::vector<torch::Tensor> request_slices;
+      if (strided) {
+        int64_t offset = 0;
+        for (const int64_t length : ragged_lengths) {
+          request_slices.push_back(
+              output.narrow(0, offset, length).unsqueeze(0));
+          offset += length;
+        }
+      }
+
+      ScatterOutput(
+          name, output_dtype, request_shapes,
+          static_cast<const char*>(output_flat.data_ptr()),
+          output_flat.nbytes(), 0 /* request_byte_stride */,
+          strided ? &request_slices : nullptr, quantize_scale, requested[b],
+          request_count, responses, &scatter_spans, &strided_copies,
+          &cuda_copy);
+      scattered_tensors.push_back(output_flat);
+    } else if (padded_output) {
+      std::vector<std::vector<int64_t>> request_shapes;
+      std::vector<torch::Tensor> request_slices;
+      for (size_t r = 0; r < ragged_lengths.size(); ++r) {
+        std::vector<int64_t> request_shape(batchn_shape);
+        request_shape[0] = 1;
+        request_shape[1] = ragged_lengths[r];
+        request_shapes.push_back(request_shape);
+        if (strided) {
+          request_slices.push_back(
+              output.narrow(0, r, 1).narrow(1, 0, ragged_lengths[r]));
+        }
+      }
+
+      // Each request starts at its row of the padded output.
+      ScatterOutput(
+          name, output_dtype, request_shapes,
+          static_cast<const char*>(output_flat.data_ptr()),
+          output_flat.nbytes(), output_flat.nbytes() / padded_batch_size,
+          strided ? &request_slices : nullptr, quantize_scale, requested[b],
+          request_count, responses, &scatter_spans, &strided_copies,
+          &cuda_copy);
+      scattered_tensors.push_back(output_flat);
+    } else if (device_.is_cpu()) {
+      std::vector<std::vector<int64_t>> request_shapes(
+          request_count, batchn_shape);
+      if (max_batch_size > 0) {
+        for (uint32_t r = 0; r < request_count; ++r) {
+          request_shapes[r][0] = request_batch_sizes[r];
+        }
+      }
+
+      // A request whose rows are past the end of the output has no
+      // slice.
+      std::vector<torch::Tensor> request_slices;
+      if (strided) {
+        int64_t row = 0;
+        for (uint32_t r = 0; r < request_count; ++r) {
+          if (max_batch_size == 0) {
+            request_slices.push_back(output);
+          } else if (row + request_batch_sizes[r] <= batchn_shape[0]) {
+            request_slices.push_back(
+                output.narrow(0, row, request_batch_sizes[r]));
+          } else {
+            request_slices.emplace_back();
+          }
+          row += request_batch_sizes[r];
+        }
+      }
+
+      ScatterOutput(
+          name, output_dtype, request_shapes, output_buffer,
+          output_flat.nbytes(), 0 /* request_byte_stride */,
+          strided ? &request_slices : nullptr, quantize_scale, requested[b],
+          request_count, responses, &scatter_spans, &strided_copies,
+          &cuda_copy);
+      scattered_tensors.push_back(output_flat);
+    } else {
+      responder.ProcessTensor(
+          name, output_dtype, batchn_shape, output_buffer,
+          TRITONSERVER_MEMORY_GPU, device_.index());
+    }
+  }
+
+  copy_engine_.Copy(scatter_spans, scatter_stats);
+  if (!strided_copies.empty()) {
+    const auto start = std::chrono::steady_clock::now();
+    for (StridedCopy& copy : strided_copies) {
+      TRITONBACKEND_Response** response = &(*responses)[copy.request];
+      if (*response == nullptr) {
+        continue;
+      }
+      try {
+        copy.dst.copy_(
+            (copy.quantize_scale > 0)
+                ? QuantizeInt8(copy.src, copy.quantize_scale)
+                : copy.src);
+        scatter_stats->bytes += copy.dst.nbytes();
+      }
+      catch (const std::exception& ex) {
+        RESPOND_AND_SET_NULL_IF_ERROR(
+            response, TRITONSERVER_ErrorNew(
+                          TRITONSERVER_ERROR_INTERNAL,
+                          (std::string("failed to copy output: ") + ex.what())
+                              .c_str()));
+      }
+    }
+    scatter_stats->copy_ns +=
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start)
+            .count();
   }
 
   // Finalize and wait for any pending buffer copies.
@@ -978,6 +4700,242 @@ ModelInstanceState::ReadOutputTensors(
 #endif  // TRITON_ENABLE_GPU
 }
 
+void
+ModelInstanceState::ScatterClassification(
+    const std::string& name, const ModelState::Classification& classification,
+    const torch::Tensor& output, const std::vector<bool>& requested,
+    const uint32_t request_count,
+    const std::vector<int64_t>& request_batch_sizes,
+    std::vector<TRITONBACKEND_Response*>* responses)
+{
+  const std::vector<std::string>& labels = classification.labels;
+
+  // The classes are the last dimension of the model output. Only the
+  // top-K scores and indices of every row leave the device.
+  torch::Tensor scores;
+  torch::Tensor indices;
+  RESPOND_ALL_AND_RETURN_IF_ERROR(
+      responses, request_count,
+      CheckClassificationOutput(name, classification, output));
+  try {
+    auto top = torch::topk(output, classification.k);
+    scores = std::get<0>(top).to(torch::kCPU, torch::kFloat).contiguous();
+    indices = std::get<1>(top).to(torch::kCPU, torch::kLong).contiguous();
+  }
+  catch (const std::exception& ex) {
+    RESPOND_ALL_AND_RETURN_IF_ERROR(
+        responses, request_count,
+        TRITONSERVER_ErrorNew(
+            TRITONSERVER_ERROR_INTERNAL,
+            (std::string("failed to classify output '") + name +
+             "': " + ex.what())
+                .c_str()));
+  }
+
+  const int64_t k = scores.size(-1);
+  const int64_t row_count = (k > 0) ? scores.numel() / k : 0;
+  const float* score_data = scores.data_ptr<float>();
+  const int64_t* index_data = indices.data_ptr<int64_t>();
+  const int max_batch_size = model_state_->MaxBatchSize();
+
+  int64_t row = 0;
+  for (uint32_t r = 0; r < request_count; ++r) {
+    TRITONBACKEND_Response** response = &(*responses)[r];
+    std::vector<int64_t> shape(scores.sizes().begin(), scores.sizes().end());
+    if (max_batch_size > 0) {
+      shape[0] = request_batch_sizes[r];
+    }
+    const int64_t rows = (k > 0) ? GetElementCount(shape) / k : 0;
+    const int64_t first_row = row;
+    row += rows;
+    if (!requested[r] || (*response == nullptr)) {
+      continue;
+    }
+    if (row > row_count) {
+      RESPOND_AND_SET_NULL_IF_ERROR(
+          response,
+          TRITONSERVER_ErrorNew(
+              TRITONSERVER_ERROR_INTERNAL,
+              (std::string("output '") + name +
+               "' has fewer rows than the batch requires")
+                  .c_str()));
+      continue;
+    }
+
+    // Serialized as BYTES elements, each a 4-byte length followed by the
+    // string.
+    std::string serialized;
+    for (int64_t i = first_row * k; i < row * k; ++i) {
+      std::string str = std::to_string(score_data[i]) + ":" +
+                        std::to_string(index_data[i]);
+      if ((index_data[i] >= 0) &&
+          (static_cast<size_t>(index_data[i]) < labels.size())) {
+        str += ":" + labels[index_data[i]];
+      }
+      const uint32_t len = str.size();
+      serialized.append(reinterpret_cast<const char*>(&len), sizeof(len));
+      serialized.append(str);
+    }
+
+    TRITONBACKEND_Output* response_output;
+    RESPOND_AND_SET_NULL_IF_ERROR(
+        response, TRITONBACKEND_ResponseOutput(
+                      *response, &response_output, name.c_str(),
+                      TRITONSERVER_TYPE_BYTES, shape.data(), shape.size()));
+    void* dst = nullptr;
+    TRITONSERVER_MemoryType memory_type = TRITONSERVER_MEMORY_CPU;
+    int64_t memory_type_id = 0;
+    if (*response != nullptr) {
+      RESPOND_AND_SET_NULL_IF_ERROR(
+          response, TRITONBACKEND_OutputBuffer(
+                        response_output, &dst, serialized.size(),
+                        &memory_type, &memory_type_id));
+    }
+    if ((*response == nullptr) || serialized.empty()) {
+      continue;
+    }
+    if (memory_type != TRITONSERVER_MEMORY_GPU) {
+      memcpy(dst, serialized.data(), serialized.size());
+    } else {
+#ifdef TRITON_ENABLE_GPU
+      cudaError_t err = cudaMemcpy(
+          dst, serialized.data(), serialized.size(), cudaMemcpyHostToDevice);
+      if (err != cudaSuccess) {
+        RESPOND_AND_SET_NULL_IF_ERROR(
+            response,
+            TRITONSERVER_ErrorNew(
+                TRITONSERVER_ERROR_INTERNAL,
+                (std::string("failed to copy output '") + name +
+                 "' to GPU memory: " + cudaGetErrorString(err))
+                    .c_str()));
+      }
+#else
+      RESPOND_AND_SET_NULL_IF_ERROR(
+          response,
+          TRITONSERVER_ErrorNew(
+              TRITONSERVER_ERROR_UNSUPPORTED,
+              (std::string("GPU buffer for output '") + name +
+               "' is not supported")
+                  .c_str()));
+#endif  // TRITON_ENABLE_GPU
+    }
+  }
+}
+
+torch::Tensor
+ModelInstanceState::QuantizeInt8(const torch::Tensor& src, const double scale)
+{
+  torch::Tensor scaled = at::mul(src, 1.0 / scale);
+  scaled.round_().clamp_(-128, 127);
+  return scaled;
+}
+
+void
+ModelInstanceState::ScatterOutput(
+    const std::string& name, const TRITONSERVER_DataType dtype,
+    const std::vector<std::vector<int64_t>>& request_shapes,
+    const char* buffer, const size_t buffer_byte_size,
+    const size_t request_byte_stride,
+    const std::vector<torch::Tensor>* request_slices,
+    const double quantize_scale, const std::vector<bool>& requested,
+    const uint32_t request_count,
+    std::vector<TRITONBACKEND_Response*>* responses,
+    std::vector<CopySpan>* spans, std::vector<StridedCopy>* strided_copies,
+    bool* cuda_copy)
+{
+  size_t offset = 0;
+  for (uint32_t r = 0; r < request_count; ++r) {
+    if (request_byte_stride > 0) {
+      offset = r * request_byte_stride;
+    }
+    const std::vector<int64_t>& shape = request_shapes[r];
+    const size_t byte_size = GetByteSize(dtype, shape);
+    TRITONBACKEND_Response** response = &(*responses)[r];
+
+    bool need_output = requested[r] && (*response != nullptr);
+
+    const bool has_slice = (request_slices != nullptr)
+                               ? (*request_slices)[r].defined()
+                               : (offset + byte_size <= buffer_byte_size);
+    if (need_output && !has_slice) {
+      RESPOND_AND_SET_NULL_IF_ERROR(
+          response,
+          TRITONSERVER_ErrorNew(
+              TRITONSERVER_ERROR_INTERNAL,
+              (std::string("output '") + name +
+               "' has fewer elements than the batch requires")
+                  .c_str()));
+      need_output = false;
+    }
+
+    if (need_output) {
+      TRITONBACKEND_Output* output;
+      RESPOND_AND_SET_NULL_IF_ERROR(
+          response, TRITONBACKEND_ResponseOutput(
+                        *response, &output, name.c_str(), dtype, shape.data(),
+                        shape.size()));
+
+      void* dst = nullptr;
+      TRITONSERVER_MemoryType memory_type = TRITONSERVER_MEMORY_CPU;
+      int64_t memory_type_id = 0;
+      if (*response != nullptr) {
+        RESPOND_AND_SET_NULL_IF_ERROR(
+            response, TRITONBACKEND_OutputBuffer(
+                          output, &dst, byte_size, &memory_type,
+                          &memory_type_id));
+      }
+
+      if ((*response != nullptr) && (byte_size > 0)) {
+        if (request_slices != nullptr) {
+          // libtorch copies the slice from its strides, converting it
+          // to 'dtype' if needed, to GPU memory through a contiguous
+          // staging copy.
+          const torch::Tensor& slice = (*request_slices)[r];
+          torch::TensorOptions options(
+              ConvertDataTypeToTorchType(dtype).second);
+          if (memory_type == TRITONSERVER_MEMORY_GPU) {
+            options =
+                options.device(torch::Device(torch::kCUDA, memory_type_id));
+          }
+          strided_copies->push_back(
+              {r, torch::from_blob(dst, slice.sizes(), options), slice,
+               quantize_scale});
+        } else if (memory_type != TRITONSERVER_MEMORY_GPU) {
+          spans->push_back(
+              {static_cast<char*>(dst), buffer + offset, byte_size});
+        } else {
+#ifdef TRITON_ENABLE_GPU
+          cudaError_t err = cudaMemcpyAsync(
+              dst, buffer + offset, byte_size, cudaMemcpyHostToDevice,
+              CudaStream());
+          if (err == cudaSuccess) {
+            *cuda_copy = true;
+          } else {
+            RESPOND_AND_SET_NULL_IF_ERROR(
+                response,
+                TRITONSERVER_ErrorNew(
+                    TRITONSERVER_ERROR_INTERNAL,
+                    (std::string("failed to copy output '") + name +
+                     "' to GPU memory: " + cudaGetErrorString(err))
+                        .c_str()));
+          }
+#else
+          RESPOND_AND_SET_NULL_IF_ERROR(
+              response,
+              TRITONSERVER_ErrorNew(
+                  TRITONSERVER_ERROR_UNSUPPORTED,
+                  (std::string("GPU buffer for output '") + name +
+                   "' is not supported")
+                      .c_str()));
+#endif  // TRITON_ENABLE_GPU
+        }
+      }
+    }
+
+    offset += byte_size;
+  }
+}
+
 /////////////
 
 extern "C" {
@@ -1025,6 +4983,113 @@ TRITONBACKEND_Initialize(TRITONBACKEND_Backend* backend)
             .c_str());
   }
 
+  // The backend configuration may contain information needed by the
+  // backend, such as command-line arguments.
+  TRITONSERVER_Message* backend_config_message;
+  RETURN_IF_ERROR(
+      TRITONBACKEND_BackendConfig(backend, &backend_config_message));
+
+  const char* buffer;
+  size_t byte_size;
+  RETURN_IF_ERROR(TRITONSERVER_MessageSerializeToJson(
+      backend_config_message, &buffer, &byte_size));
+
+  triton::common::TritonJson::Value backend_config;
+  if (byte_size != 0) {
+    RETURN_IF_ERROR(backend_config.Parse(buffer, byte_size));
+  }
+
+  // By default load at most 4 models in parallel, loading is mostly
+  // bound by storage and memory bandwidth rather than by compute.
+  int model_load_thread_count = std::min(
+      4, std::max(1, static_cast<int>(std::thread::hardware_concurrency())));
+  // Copies of large batches are spread over the calling thread and at
+  // most this many helper threads.
+  int copy_thread_count = std::min(
+      4,
+      std::max(0, static_cast<int>(std::thread::hardware_concurrency()) - 1));
+  std::string model_cache_directory;
+  // Cores that CPU instances are pinned to, none by default.
+  std::vector<int> core_budget;
+  triton::common::TritonJson::Value cmdline;
+  if (backend_config.Find("cmdline", &cmdline)) {
+    triton::common::TritonJson::Value value;
+    if (cmdline.Find("model-load-thread-count", &value)) {
+      std::string value_str;
+      RETURN_IF_ERROR(value.AsString(&value_str));
+      RETURN_IF_ERROR(ParseIntValue(value_str, &model_load_thread_count));
+      RETURN_ERROR_IF_FALSE(
+          model_load_thread_count > 0, TRITONSERVER_ERROR_INVALID_ARG,
+          std::string("model-load-thread-count must be positive"));
+    }
+    if (cmdline.Find("copy-thread-count", &value)) {
+      std::string value_str;
+      RETURN_IF_ERROR(value.AsString(&value_str));
+      RETURN_IF_ERROR(ParseIntValue(value_str, &copy_thread_count));
+      RETURN_ERROR_IF_FALSE(
+          copy_thread_count >= 0, TRITONSERVER_ERROR_INVALID_ARG,
+          std::string("copy-thread-count must not be negative"));
+    }
+    if (cmdline.Find("model-cache-directory", &value)) {
+      RETURN_IF_ERROR(value.AsString(&model_cache_directory));
+    }
+    if (cmdline.Find("cpu-core-budget", &value)) {
+      std::string value_str;
+      RETURN_IF_ERROR(value.AsString(&value_str));
+      if (value_str == "all") {
+        RETURN_IF_ERROR(GetProcessCpus(&core_budget));
+      } else {
+        RETURN_IF_ERROR(ParseCpuList(value_str, &core_budget));
+      }
+    }
+  }
+
+  LOG_MESSAGE(
+      TRITONSERVER_LOG_INFO,
+      (std::string("'") + name + "' model load thread count: " +
+       std::to_string(model_load_thread_count) +
+       ", copy thread count: " + std::to_string(copy_thread_count) +
+       ", model cache directory: '" + model_cache_directory +
+       "', CPU core budget: " + std::to_string(core_budget.size()) +
+       " cores")
+          .c_str());
+
+  // The placement of instances on NUMA nodes is logged as they are
+  // created.
+  const std::vector<NumaNode> numa_nodes = GetNumaNodes();
+  std::string numa_str;
+  for (const auto& node : numa_nodes) {
+    numa_str += std::string(numa_str.empty() ? "" : ", ") + "node " +
+                std::to_string(node.id) + " with " +
+                std::to_string(node.cpus.size()) + " CPUs";
+  }
+  LOG_MESSAGE(
+      TRITONSERVER_LOG_INFO,
+      (std::string("'") + name + "' NUMA nodes: " +
+       (numa_str.empty() ? std::string("unknown") : numa_str))
+          .c_str());
+
+  BackendState* backend_state = new BackendState(
+      model_load_thread_count, copy_thread_count, model_cache_directory,
+      core_budget, numa_nodes);
+  RETURN_IF_ERROR(TRITONBACKEND_BackendSetState(
+      backend, reinterpret_cast<void*>(backend_state)));
+
+  return nullptr;  // success
+}
+
+TRITONSERVER_Error*
+TRITONBACKEND_Finalize(TRITONBACKEND_Backend* backend)
+{
+  void* vstate;
+  RETURN_IF_ERROR(TRITONBACKEND_BackendState(backend, &vstate));
+  BackendState* backend_state = reinterpret_cast<BackendState*>(vstate);
+
+  LOG_MESSAGE(
+      TRITONSERVER_LOG_INFO, "TRITONBACKEND_Finalize: delete backend state");
+
+  delete backend_state;
+
   return nullptr;  // success
 }
 
@@ -1144,7 +5209,10 @@ TRITONBACKEND_ModelInstanceExecute(
   // we should not return from this function until execution is
   // complete. Triton will automatically release 'instance' on return
   // from this function so that it is again available to be used for
-  // another call to TRITONBACKEND_ModelInstanceExecute.
+  // another call to TRITONBACKEND_ModelInstanceExecute. With
+  // ASYNC_EXECUTION the requests are instead executed, responded to
+  // and released by the model's worker pool, so that the instance can
+  // take its next requests right away.
 
   LOG_MESSAGE(
       TRITONSERVER_LOG_VERBOSE,
@@ -0,0 +1,164 @@
+// Copyright (c) 2021, NVIDIA CORPORATION. All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//  * Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//  * Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//  * Neither the name of NVIDIA CORPORATION nor the names of its
+//    contributors may be used to endorse or promote products derived
+//    from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+// PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+// OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+#include "libtorch_buffer_arena.h"
+
+#include <unistd.h>
+#include <string>
+#include "libtorch_utils.h"
+#include "triton/backend/backend_common.h"
+
+namespace triton { namespace backend { namespace pytorch {
+
+namespace {
+
+// Smallest buffer handed out by the arena.
+constexpr size_t kMinSizeClass = 4096;
+
+size_t
+SizeClass(const size_t byte_size)
+{
+  size_t size_class = kMinSizeClass;
+  while (size_class < byte_size) {
+    size_class <<= 1;
+  }
+  return size_class;
+}
+
+}  // namespace
+
+BufferArena::BufferArena(
+    TRITONBACKEND_MemoryManager* memory_manager,
+    const std::vector<BackendMemory::AllocationType>& alloc_types,
+    const int64_t memory_type_id, const size_t slot_count,
+    const uint64_t shrink_interval, const int numa_node)
+    : memory_manager_(memory_manager), alloc_types_(alloc_types),
+      memory_type_id_(memory_type_id), shrink_interval_(shrink_interval),
+      numa_node_(numa_node), execution_count_(0), slots_(slot_count)
+{
+}
+
+BufferArena::~BufferArena()
+{
+  for (auto& slot : slots_) {
+    delete slot.memory_;
+  }
+}
+
+TRITONSERVER_Error*
+BufferArena::Reserve(const size_t slot, const size_t byte_size)
+{
+  Slot& s = slots_[slot];
+  if ((s.memory_ == nullptr) || (s.memory_->ByteSize() < byte_size)) {
+    RETURN_IF_ERROR(Grow(&s, byte_size));
+  }
+
+  return nullptr;  // success
+}
+
+TRITONSERVER_Error*
+BufferArena::Acquire(
+    const size_t slot, const size_t byte_size, char** buffer,
+    TRITONSERVER_MemoryType* memory_type, int64_t* memory_type_id)
+{
+  Slot& s = slots_[slot];
+  if ((s.memory_ == nullptr) || (s.memory_->ByteSize() < byte_size)) {
+    RETURN_IF_ERROR(Grow(&s, byte_size));
+  }
+  if (byte_size > s.peak_byte_size_) {
+    s.peak_byte_size_ = byte_size;
+  }
+
+  *buffer = s.memory_->MemoryPtr();
+  *memory_type = s.memory_->MemoryType();
+  *memory_type_id = s.memory_->MemoryTypeId();
+
+  return nullptr;  // success
+}
+
+void
+BufferArena::EndExecution()
+{
+  ++execution_count_;
+  if ((shrink_interval_ == 0) || ((execution_count_ % shrink_interval_) != 0)) {
+    return;
+  }
+
+  for (size_t i = 0; i < slots_.size(); ++i) {
+    Slot& s = slots_[i];
+    if ((s.memory_ != nullptr) &&
+        (SizeClass(s.peak_byte_size_) * 4 <= s.memory_->ByteSize())) {
+      LOG_MESSAGE(
+          TRITONSERVER_LOG_VERBOSE,
+          (std::string("releasing input buffer ") + std::to_string(i) +
+           " of " + std::to_string(s.memory_->ByteSize()) +
+           " bytes, largest use in the last " +
+           std::to_string(shrink_interval_) + " executions was " +
+           std::to_string(s.peak_byte_size_) + " bytes")
+              .c_str());
+      delete s.memory_;
+      s.memory_ = nullptr;
+    }
+    s.peak_byte_size_ = 0;
+  }
+}
+
+TRITONSERVER_Error*
+BufferArena::Grow(Slot* slot, const size_t byte_size)
+{
+  delete slot->memory_;
+  slot->memory_ = nullptr;
+
+  BackendMemory* memory;
+  RETURN_IF_ERROR(BackendMemory::Create(
+      memory_manager_, alloc_types_, memory_type_id_, SizeClass(byte_size),
+      &memory));
+  slot->memory_ = memory;
+
+  // Pageable memory goes to the NUMA node of the instance whichever
+  // thread touches it first.
+  if ((memory->MemoryType() == TRITONSERVER_MEMORY_CPU) &&
+      (numa_node_ >= 0)) {
+    LOG_IF_ERROR(
+        BindMemoryToNode(memory->MemoryPtr(), memory->ByteSize(), numa_node_),
+        ("failed to bind input buffer to NUMA node " +
+         std::to_string(numa_node_))
+            .c_str());
+  }
+
+  // Touch every page of CPU memory now rather than on the execution
+  // path.
+  if (memory->MemoryType() != TRITONSERVER_MEMORY_GPU) {
+    const size_t page_size = sysconf(_SC_PAGESIZE);
+    char* base = memory->MemoryPtr();
+    for (size_t offset = 0; offset < memory->ByteSize(); offset += page_size) {
+      base[offset] = 0;
+    }
+  }
+
+  return nullptr;  // success
+}
+
+}}}  // namespace triton::backend::pytorch
@@ -0,0 +1,94 @@
+// Copyright (c) 2021, NVIDIA CORPORATION. All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//  * Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//  * Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//  * Neither the name of NVIDIA CORPORATION nor the names of its
+//    contributors may be used to endorse or promote products derived
+//    from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+// PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+// OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "triton/backend/backend_memory.h"
+
+namespace triton { namespace backend { namespace pytorch {
+
+//
+// BufferArena
+//
+// Per-instance set of batch buffers, one slot per model input, that is
+// reused across executions instead of allocating and freeing a
+// BackendMemory on every call. Buffers are allocated in power-of-two
+// size classes, grow only when a larger batch arrives and are
+// pre-faulted when CPU memory is allocated so that executions don't
+// take first-touch page faults. Every 'shrink_interval' executions a
+// buffer whose largest use in that interval fits in a size class at
+// least two classes smaller is released, to be reallocated at the
+// smaller size on its next use. A 'shrink_interval' of 0 never
+// shrinks. CPU buffers are bound to NUMA node 'numa_node' unless it is
+// negative.
+//
+class BufferArena {
+ public:
+  BufferArena(
+      TRITONBACKEND_MemoryManager* memory_manager,
+      const std::vector<BackendMemory::AllocationType>& alloc_types,
+      const int64_t memory_type_id, const size_t slot_count,
+      const uint64_t shrink_interval, const int numa_node = -1);
+  ~BufferArena();
+
+  BufferArena(const BufferArena&) = delete;
+  BufferArena& operator=(const BufferArena&) = delete;
+
+  // Make sure 'slot' holds a buffer of at least 'byte_size' bytes.
+  TRITONSERVER_Error* Reserve(const size_t slot, const size_t byte_size);
+
+  // Return in 'buffer' a buffer of at least 'byte_size' bytes for
+  // 'slot'. The buffer stays valid until the next call for the same
+  // slot or until EndExecution() releases it.
+  TRITONSERVER_Error* Acquire(
+      const size_t slot, const size_t byte_size, char** buffer,
+      TRITONSERVER_MemoryType* memory_type, int64_t* memory_type_id);
+
+  // Called once the buffers of an execution are no longer needed.
+  void EndExecution();
+
+ private:
+  struct Slot {
+    Slot() : memory_(nullptr), peak_byte_size_(0) {}
+    BackendMemory* memory_;
+    // Largest size requested since the last shrink check.
+    size_t peak_byte_size_;
+  };
+
+  TRITONSERVER_Error* Grow(Slot* slot, const size_t byte_size);
+
+  TRITONBACKEND_MemoryManager* memory_manager_;
+  const std::vector<BackendMemory::AllocationType> alloc_types_;
+  const int64_t memory_type_id_;
+  const uint64_t shrink_interval_;
+  const int numa_node_;
+  uint64_t execution_count_;
+  std::vector<Slot> slots_;
+};
+
+}}}  // namespace triton::backend::pytorch
@@ -0,0 +1,177 @@
+// Copyright (c) 2021, NVIDIA CORPORATION. All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//  * Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//  * Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//  * Neither the name of NVIDIA CORPORATION nor the names of its
+//    contributors may be used to endorse or promote products derived
+//    from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+// PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+// OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+#include "libtorch_copy.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <memory>
+#include <mutex>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif  // __SSE2__
+
+namespace triton { namespace backend { namespace pytorch {
+
+namespace {
+
+// Batches copying fewer bytes than this are copied serially, the cost
+// of waking up pool threads would exceed the copy itself.
+constexpr size_t kParallelCopyThreshold = 1 << 20;
+
+// Spans are split into chunks of at most this size so that a few large
+// requests still spread over all threads.
+constexpr size_t kChunkSize = 256 << 10;
+
+// Spans at least this large are copied with non-temporal stores.
+constexpr size_t kNonTemporalThreshold = 512 << 10;
+
+// Copy with stores that bypass the cache.
+void
+NonTemporalCopy(char* dst, const char* src, size_t size)
+{
+#if defined(__SSE2__)
+  // Streaming stores need a 16-byte aligned destination.
+  const size_t head = std::min(
+      size, (16 - (reinterpret_cast<uintptr_t>(dst) & 15)) & 15);
+  std::memcpy(dst, src, head);
+  dst += head;
+  src += head;
+  size -= head;
+
+  for (; size >= 64; size -= 64, src += 64, dst += 64) {
+    const __m128i a =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+    const __m128i b =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 16));
+    const __m128i c =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 32));
+    const __m128i d =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 48));
+    _mm_stream_si128(reinterpret_cast<__m128i*>(dst), a);
+    _mm_stream_si128(reinterpret_cast<__m128i*>(dst + 16), b);
+    _mm_stream_si128(reinterpret_cast<__m128i*>(dst + 32), c);
+    _mm_stream_si128(reinterpret_cast<__m128i*>(dst + 48), d);
+  }
+  std::memcpy(dst, src, size);
+
+  // Make the streamed data visible before the copy is reported done.
+  _mm_sfence();
+#else
+  std::memcpy(dst, src, size);
+#endif  // __SSE2__
+}
+
+void
+CopyChunk(const CopySpan& chunk, const bool non_temporal)
+{
+  if (non_temporal) {
+    NonTemporalCopy(chunk.dst, chunk.src, chunk.size);
+  } else {
+    std::memcpy(chunk.dst, chunk.src, chunk.size);
+  }
+}
+
+// Chunks of one parallel copy shared by the participating threads.
+struct ParallelCopy {
+  std::vector<CopySpan> chunks;
+  std::vector<bool> non_temporal;
+  std::atomic<size_t> next_chunk;
+
+  std::mutex mu;
+  std::condition_variable cv;
+  size_t pending_workers;
+
+  // Copy chunks until none is left.
+  void Run()
+  {
+    for (size_t i = next_chunk++; i < chunks.size(); i = next_chunk++) {
+      CopyChunk(chunks[i], non_temporal[i]);
+    }
+  }
+};
+
+}  // namespace
+
+void
+CopyEngine::Copy(const std::vector<CopySpan>& spans, CopyStats* stats)
+{
+  const auto start = std::chrono::steady_clock::now();
+
+  size_t total_bytes = 0;
+  for (const auto& span : spans) {
+    total_bytes += span.size;
+  }
+
+  if ((pool_ == nullptr) || (pool_->Size() == 0) ||
+      (total_bytes < kParallelCopyThreshold)) {
+    for (const auto& span : spans) {
+      CopyChunk(span, span.size >= kNonTemporalThreshold);
+    }
+  } else {
+    std::shared_ptr<ParallelCopy> copy = std::make_shared<ParallelCopy>();
+    for (const auto& span : spans) {
+      const bool non_temporal = span.size >= kNonTemporalThreshold;
+      for (size_t offset = 0; offset < span.size; offset += kChunkSize) {
+        copy->chunks.push_back(
+            {span.dst + offset, span.src + offset,
+             std::min(kChunkSize, span.size - offset)});
+        copy->non_temporal.push_back(non_temporal);
+      }
+    }
+    copy->next_chunk = 0;
+
+    // The calling thread copies as well, so one less worker is needed.
+    const size_t worker_count =
+        std::min(pool_->Size(), copy->chunks.size() - 1);
+    copy->pending_workers = worker_count;
+    for (size_t i = 0; i < worker_count; ++i) {
+      pool_->Enqueue([copy] {
+        copy->Run();
+        std::lock_guard<std::mutex> lk(copy->mu);
+        if (--copy->pending_workers == 0) {
+          copy->cv.notify_one();
+        }
+      });
+    }
+
+    copy->Run();
+
+    // Workers may still be copying their last chunk.
+    std::unique_lock<std::mutex> lk(copy->mu);
+    copy->cv.wait(lk, [&copy] { return copy->pending_workers == 0; });
+  }
+
+  stats->bytes += total_bytes;
+  stats->copy_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        std::chrono::steady_clock::now() - start)
+                        .count();
+}
+
+}}}  // namespace triton::backend::pytorch
@@ -0,0 +1,73 @@
+// Copyright (c) 2021, NVIDIA CORPORATION. All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//  * Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//  * Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//  * Neither the name of NVIDIA CORPORATION nor the names of its
+//    contributors may be used to endorse or promote products derived
+//    from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+// PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+// OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "libtorch_thread_pool.h"
+
+namespace triton { namespace backend { namespace pytorch {
+
+// A copy of 'size' bytes from 'src' to 'dst'. Spans must not overlap.
+struct CopySpan {
+  char* dst;
+  const char* src;
+  size_t size;
+};
+
+// Bytes copied and time spent copying, accumulated over calls.
+struct CopyStats {
+  CopyStats() : bytes(0), copy_ns(0) {}
+  uint64_t bytes;
+  uint64_t copy_ns;
+};
+
+//
+// CopyEngine
+//
+// Runs the host-to-host copies that gather request inputs into a batch
+// buffer and scatter batch outputs into response buffers. Batches that
+// copy enough bytes are split into chunks that the calling thread and
+// the threads of 'pool' copy in parallel, other batches are copied
+// serially on the calling thread. Large spans are written with
+// non-temporal stores when available so that they don't evict the
+// working set of the model from the cache.
+//
+class CopyEngine {
+ public:
+  // 'pool' may be nullptr, in which case all copies are serial.
+  explicit CopyEngine(ThreadPool* pool) : pool_(pool) {}
+
+  // Copy all 'spans' and return once every copy is complete. The bytes
+  // copied and time spent are added to 'stats'.
+  void Copy(const std::vector<CopySpan>& spans, CopyStats* stats);
+
+ private:
+  ThreadPool* pool_;
+};
+
+}}}  // namespace triton::backend::pytorch
@@ -0,0 +1,172 @@
+// Copyright (c) 2021, NVIDIA CORPORATION. All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//  * Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//  * Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//  * Neither the name of NVIDIA CORPORATION nor the names of its
+//    contributors may be used to endorse or promote products derived
+//    from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+// PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+// OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "libtorch_thread_pool.h"
+
+namespace triton { namespace backend { namespace pytorch {
+
+ThreadPool::ThreadPool(const size_t thread_count) : exiting_(false)
+{
+  threads_.reserve(thread_count);
+  for (size_t i = 0; i < thread_count; ++i) {
+    threads_.emplace_back(&ThreadPool::Worker, this);
+  }
+}
+
+ThreadPool::~ThreadPool()
+{
+  {
+    std::lock_guard<std::mutex> lk(mu_);
+    exiting_ = true;
+  }
+  cv_.notify_all();
+
+  for (auto& thread : threads_) {
+    if (thread.joinable()) {
+      thread.join();
+    }
+  }
+}
+
+void
+ThreadPool::Enqueue(std::function<void()>&& task)
+{
+  {
+    std::lock_guard<std::mutex> lk(mu_);
+    tasks_.emplace_back(std::move(task));
+  }
+  cv_.notify_one();
+}
+
+void
+ThreadPool::Worker()
+{
+  while (true) {
+    std::function<void()> task;
+    {
+      std::unique_lock<std::mutex> lk(mu_);
+      cv_.wait(lk, [this] { return exiting_ || !tasks_.empty(); });
+      if (tasks_.empty()) {
+        // Only reached when exiting and there is no more work.
+        return;
+      }
+      task = std::move(tasks_.front());
+      tasks_.pop_front();
+    }
+
+    task();
+  }
+}
+
+WorkStealingPool::WorkStealingPool(const size_t worker_count)
+    : next_queue_(0), pending_(0), exiting_(false)
+{
+  for (size_t i = 0; i < worker_count; ++i) {
+    queues_.emplace_back(new WorkerQueue());
+  }
+  threads_.reserve(worker_count);
+  for (size_t i = 0; i < worker_count; ++i) {
+    threads_.emplace_back(&WorkStealingPool::Worker, this, i);
+  }
+}
+
+WorkStealingPool::~WorkStealingPool()
+{
+  {
+    std::lock_guard<std::mutex> lk(mu_);
+    exiting_ = true;
+  }
+  cv_.notify_all();
+
+  for (auto& thread : threads_) {
+    if (thread.joinable()) {
+      thread.join();
+    }
+  }
+}
+
+void
+WorkStealingPool::Enqueue(Task&& task)
+{
+  // The task is counted before it is published so that a worker that
+  // takes it right away never uncounts it first.
+  {
+    std::lock_guard<std::mutex> lk(mu_);
+    ++pending_;
+  }
+  WorkerQueue& queue = *queues_[next_queue_++ % queues_.size()];
+  {
+    std::lock_guard<std::mutex> lk(queue.mu_);
+    queue.tasks_.emplace_back(std::move(task));
+  }
+  cv_.notify_one();
+}
+
+bool
+WorkStealingPool::TryPop(const size_t index, Task* task)
+{
+  for (size_t i = 0; i < queues_.size(); ++i) {
+    WorkerQueue& queue = *queues_[(index + i) % queues_.size()];
+    std::lock_guard<std::mutex> lk(queue.mu_);
+    if (queue.tasks_.empty()) {
+      continue;
+    }
+    // Stolen tasks are also taken oldest first so that no task waits
+    // behind ones enqueued after it.
+    *task = std::move(queue.tasks_.front());
+    queue.tasks_.pop_front();
+    return true;
+  }
+  return false;
+}
+
+void
+WorkStealingPool::Worker(const size_t index)
+{
+  while (true) {
+    Task task;
+    if (TryPop(index, &task)) {
+      {
+        std::lock_guard<std::mutex> lk(mu_);
+        --pending_;
+      }
+      task(index);
+      continue;
+    }
+
+    // A task counted in 'pending_' may just have been taken by another
+    // worker that hasn't uncounted it yet, in which case the wait
+    // returns right away and the queues are checked again.
+    std::unique_lock<std::mutex> lk(mu_);
+    cv_.wait(lk, [this] { return exiting_ || (pending_ > 0); });
+    if (pending_ == 0) {
+      // Only reached when exiting and there is no more work.
+      return;
+    }
+  }
+}
+
+}}}  // namespace triton::backend::pytorch
@@ -0,0 +1,119 @@
+// Copyright (c) 2021, NVIDIA CORPORATION. All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions
+// are met:
+//  * Redistributions of source code must retain the above copyright
+//    notice, this list of conditions and the following disclaimer.
+//  * Redistributions in binary form must reproduce the above copyright
+//    notice, this list of conditions and the following disclaimer in the
+//    documentation and/or other materials provided with the distribution.
+//  * Neither the name of NVIDIA CORPORATION nor the names of its
+//    contributors may be used to endorse or promote products derived
+//    from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS ``AS IS'' AND ANY
+// EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+// PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+// CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+// EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+// PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+// PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY
+// OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace triton { namespace backend { namespace pytorch {
+
+//
+// ThreadPool
+//
+// Fixed-size pool of threads that run tasks in FIFO order. The
+// destructor finishes all tasks that are already enqueued before
+// joining the threads.
+//
+class ThreadPool {
+ public:
+  explicit ThreadPool(const size_t thread_count);
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  // Enqueue 'task' to be run by one of the threads of the pool.
+  void Enqueue(std::function<void()>&& task);
+
+  size_t Size() const { return threads_.size(); }
+
+ private:
+  void Worker();
+
+  std::mutex mu_;
+  std::condition_variable cv_;
+  std::deque<std::function<void()>> tasks_;
+  bool exiting_;
+  std::vector<std::thread> threads_;
+};
+
+//
+// WorkStealingPool
+//
+// Fixed-size pool of workers that each own a queue of tasks. Tasks are
+// spread over the queues round-robin, a worker runs the tasks of its
+// own queue in FIFO order and, once that is empty, steals the oldest
+// task of another worker so that no worker idles while work is
+// queued. Tasks may therefore complete out of order. A task is given
+// the index of the worker that runs it. The destructor finishes all
+// tasks that are already enqueued before joining the workers.
+//
+class WorkStealingPool {
+ public:
+  using Task = std::function<void(size_t)>;
+
+  explicit WorkStealingPool(const size_t worker_count);
+  ~WorkStealingPool();
+
+  WorkStealingPool(const WorkStealingPool&) = delete;
+  WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+  void Enqueue(Task&& task);
+
+  size_t Size() const { return threads_.size(); }
+
+ private:
+  struct WorkerQueue {
+    std::mutex mu_;
+    std::deque<Task> tasks_;
+  };
+
+  void Worker(const size_t index);
+
+  // Take the next task of worker 'index' or, if it has none, steal one
+  // from another worker.
+  bool TryPop(const size_t index, Task* task);
+
+  std::vector<std::unique_ptr<WorkerQueue>> queues_;
+  std::atomic<size_t> next_queue_;
+
+  // Number of tasks in all queues, the workers sleep while it is 0.
+  std::mutex mu_;
+  std::condition_variable cv_;
+  size_t pending_;
+  bool exiting_;
+
+  std::vector<std::thread> threads_;
+};
+
+}}}  // namespace triton::backend::pytorch
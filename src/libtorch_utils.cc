@@ -26,6 +26,21 @@
 
 #include "libtorch_utils.h"
 
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+
 namespace triton { namespace backend { namespace pytorch {
 
 TRITONSERVER_DataType
@@ -46,6 +61,8 @@ ConvertTorchTypeToDataType(const torch::ScalarType& stype)
       return TRITONSERVER_TYPE_INT64;
     case torch::kHalf:
       return TRITONSERVER_TYPE_FP16;
+    case torch::kBFloat16:
+      return TRITONSERVER_TYPE_BF16;
     case torch::kFloat:
       return TRITONSERVER_TYPE_FP32;
     case torch::kDouble:
@@ -83,6 +100,9 @@ ConvertDataTypeToTorchType(const TRITONSERVER_DataType dtype)
     case TRITONSERVER_TYPE_FP16:
       type = torch::kHalf;
       break;
+    case TRITONSERVER_TYPE_BF16:
+      type = torch::kBFloat16;
+      break;
     case TRITONSERVER_TYPE_FP32:
       type = torch::kFloat;
       break;
@@ -126,6 +146,8 @@ ModelConfigDataTypeToTorchType(const std::string& data_type_str)
     type = torch::kLong;
   } else if (dtype == "FP16") {
     type = torch::kHalf;
+  } else if (dtype == "BF16") {
+    type = torch::kBFloat16;
   } else if (dtype == "FP32") {
     type = torch::kFloat;
   } else if (dtype == "FP64") {
@@ -137,4 +159,501 @@ ModelConfigDataTypeToTorchType(const std::string& data_type_str)
   return std::make_pair(true, type);
 }
 
+TRITONSERVER_Error*
+ParseParameter(
+    triton::common::TritonJson::Value& params, const std::string& mkey,
+    bool* value)
+{
+  std::string value_str;
+  RETURN_IF_ERROR(GetParameterValue(params, mkey, &value_str));
+  RETURN_IF_ERROR(ParseBoolValue(value_str, value));
+
+  return nullptr;  // success
+}
+
+TRITONSERVER_Error*
+ParseParameter(
+    triton::common::TritonJson::Value& params, const std::string& mkey,
+    int* value)
+{
+  std::string value_str;
+  RETURN_IF_ERROR(GetParameterValue(params, mkey, &value_str));
+  RETURN_IF_ERROR(ParseIntValue(value_str, value));
+
+  return nullptr;  // success
+}
+
+TRITONSERVER_Error*
+ParseParameter(
+    triton::common::TritonJson::Value& params, const std::string& mkey,
+    std::string* value)
+{
+  RETURN_IF_ERROR(GetParameterValue(params, mkey, value));
+
+  return nullptr;  // success
+}
+
+TRITONSERVER_Error*
+ParseParameter(
+    triton::common::TritonJson::Value& params, const std::string& mkey,
+    std::vector<int64_t>* value)
+{
+  std::string value_str;
+  RETURN_IF_ERROR(GetParameterValue(params, mkey, &value_str));
+
+  value->clear();
+  for (const auto& item : SplitString(value_str, ',')) {
+    int64_t parsed;
+    RETURN_IF_ERROR(ParseLongLongValue(item, &parsed));
+    value->push_back(parsed);
+  }
+
+  return nullptr;  // success
+}
+
+std::vector<std::string>
+SplitString(const std::string& str, const char delim)
+{
+  static const char* whitespace = " \t\n\r";
+
+  std::vector<std::string> pieces;
+  size_t start = 0;
+  while (start <= str.size()) {
+    size_t end = str.find(delim, start);
+    if (end == std::string::npos) {
+      end = str.size();
+    }
+
+    const std::string piece = str.substr(start, end - start);
+    const size_t first = piece.find_first_not_of(whitespace);
+    if (first != std::string::npos) {
+      const size_t last = piece.find_last_not_of(whitespace);
+      pieces.emplace_back(piece.substr(first, last - first + 1));
+    }
+
+    start = end + 1;
+  }
+
+  return pieces;
+}
+
+int
+NamingConventionIndex(const std::string& tensor_name)
+{
+  const size_t start_pos = tensor_name.find("__");
+  if (start_pos == std::string::npos) {
+    return -1;
+  }
+
+  return std::atoi(tensor_name.substr(start_pos + 2).c_str());
+}
+
+int64_t
+RoundUpToBucket(const std::vector<int64_t>& buckets, const int64_t size)
+{
+  const auto itr = std::lower_bound(buckets.begin(), buckets.end(), size);
+  return (itr == buckets.end()) ? size : *itr;
+}
+
+TRITONSERVER_Error*
+ParseCpuList(const std::string& str, std::vector<int>* cpus)
+{
+  cpus->clear();
+  for (const auto& item : SplitString(str, ',')) {
+    const size_t dash = item.find('-');
+    int first, last;
+    RETURN_IF_ERROR(ParseIntValue(item.substr(0, dash), &first));
+    if (dash == std::string::npos) {
+      last = first;
+    } else {
+      RETURN_IF_ERROR(ParseIntValue(item.substr(dash + 1), &last));
+    }
+    if ((first < 0) || (last < first) || (last >= CPU_SETSIZE)) {
+      return TRITONSERVER_ErrorNew(
+          TRITONSERVER_ERROR_INVALID_ARG,
+          (std::string("invalid CPU range '") + item + "'").c_str());
+    }
+    for (int cpu = first; cpu <= last; ++cpu) {
+      cpus->push_back(cpu);
+    }
+  }
+
+  std::sort(cpus->begin(), cpus->end());
+  cpus->erase(std::unique(cpus->begin(), cpus->end()), cpus->end());
+  return nullptr;  // success
+}
+
+TRITONSERVER_Error*
+GetProcessCpus(std::vector<int>* cpus)
+{
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (sched_getaffinity(0, sizeof(set), &set) != 0) {
+    return TRITONSERVER_ErrorNew(
+        TRITONSERVER_ERROR_INTERNAL,
+        (std::string("failed to get CPU affinity: ") + strerror(errno))
+            .c_str());
+  }
+
+  cpus->clear();
+  for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+    if (CPU_ISSET(cpu, &set)) {
+      cpus->push_back(cpu);
+    }
+  }
+  return nullptr;  // success
+}
+
+TRITONSERVER_Error*
+SetThreadAffinity(const std::vector<int>& cpus)
+{
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (const int cpu : cpus) {
+    CPU_SET(cpu, &set);
+  }
+
+  const int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+  if (err != 0) {
+    return TRITONSERVER_ErrorNew(
+        TRITONSERVER_ERROR_INTERNAL,
+        (std::string("failed to set CPU affinity: ") + strerror(err))
+            .c_str());
+  }
+  return nullptr;  // success
+}
+
+ScopedThreadAffinity::ScopedThreadAffinity(const std::vector<int>& cpus)
+    : restore_(false)
+{
+  CPU_ZERO(&saved_set_);
+  if (cpus.empty()) {
+    return;
+  }
+
+  const int err =
+      pthread_getaffinity_np(pthread_self(), sizeof(saved_set_), &saved_set_);
+  if (err != 0) {
+    LOG_MESSAGE(
+        TRITONSERVER_LOG_WARN,
+        (std::string("failed to get CPU affinity, not pinning thread: ") +
+         strerror(err))
+            .c_str());
+    return;
+  }
+  TRITONSERVER_Error* set_err = SetThreadAffinity(cpus);
+  if (set_err != nullptr) {
+    LOG_IF_ERROR(set_err, "failed to pin thread");
+    return;
+  }
+  restore_ = true;
+}
+
+ScopedThreadAffinity::~ScopedThreadAffinity()
+{
+  if (restore_) {
+    const int err = pthread_setaffinity_np(
+        pthread_self(), sizeof(saved_set_), &saved_set_);
+    if (err != 0) {
+      LOG_MESSAGE(
+          TRITONSERVER_LOG_ERROR,
+          (std::string("failed to restore CPU affinity: ") + strerror(err))
+              .c_str());
+    }
+  }
+}
+
+ScopedIntraOpThreads::ScopedIntraOpThreads(const int thread_count)
+    : previous_thread_count_(0)
+{
+  if (thread_count > 0) {
+    const int current = at::get_num_threads();
+    if (current != thread_count) {
+      previous_thread_count_ = current;
+      at::set_num_threads(thread_count);
+    }
+  }
+}
+
+ScopedIntraOpThreads::~ScopedIntraOpThreads()
+{
+  if (previous_thread_count_ > 0) {
+    at::set_num_threads(previous_thread_count_);
+  }
+}
+
+std::vector<NumaNode>
+GetNumaNodes()
+{
+  std::vector<NumaNode> nodes;
+  const std::string node_root = "/sys/devices/system/node";
+  DIR* dir = opendir(node_root.c_str());
+  if (dir == nullptr) {
+    return nodes;
+  }
+
+  struct dirent* entry;
+  while ((entry = readdir(dir)) != nullptr) {
+    const std::string name = entry->d_name;
+    if ((name.rfind("node", 0) != 0) || (name.size() == 4) ||
+        (name.find_first_not_of("0123456789", 4) != std::string::npos)) {
+      continue;
+    }
+
+    std::ifstream cpulist(node_root + "/" + name + "/cpulist");
+    std::string cpus_str;
+    std::getline(cpulist, cpus_str);
+    NumaNode node;
+    node.id = std::atoi(name.c_str() + 4);
+    TRITONSERVER_Error* err = ParseCpuList(cpus_str, &node.cpus);
+    if (err != nullptr) {
+      TRITONSERVER_ErrorDelete(err);
+      continue;
+    }
+    // Nodes with memory only can't run instances.
+    if (!node.cpus.empty()) {
+      nodes.push_back(node);
+    }
+  }
+  closedir(dir);
+
+  std::sort(
+      nodes.begin(), nodes.end(),
+      [](const NumaNode& a, const NumaNode& b) { return a.id < b.id; });
+  return nodes;
+}
+
+TRITONSERVER_Error*
+SetThreadMemoryNode(const int node)
+{
+  // The policy modes of set_mempolicy(2), spelled out to not depend on
+  // the libnuma headers.
+  static const int kMpolDefault = 0;
+  static const int kMpolPreferred = 1;
+
+  long ret;
+  if (node < 0) {
+    ret = syscall(SYS_set_mempolicy, kMpolDefault, nullptr, 0);
+  } else {
+    const size_t bits = 8 * sizeof(unsigned long);
+    std::vector<unsigned long> mask(node / bits + 1, 0);
+    mask[node / bits] |= 1UL << (node % bits);
+    ret = syscall(
+        SYS_set_mempolicy, kMpolPreferred, mask.data(),
+        mask.size() * bits + 1);
+  }
+  if (ret != 0) {
+    return TRITONSERVER_ErrorNew(
+        TRITONSERVER_ERROR_INTERNAL,
+        (std::string("failed to set memory policy: ") + strerror(errno))
+            .c_str());
+  }
+  return nullptr;  // success
+}
+
+TRITONSERVER_Error*
+BindMemoryToNode(void* base, const size_t byte_size, const int node)
+{
+  static const int kMpolPreferred = 1;
+
+  // mbind(2) takes whole pages.
+  const uintptr_t page_size = sysconf(_SC_PAGESIZE);
+  const uintptr_t begin =
+      (reinterpret_cast<uintptr_t>(base) + page_size - 1) & ~(page_size - 1);
+  const uintptr_t end =
+      (reinterpret_cast<uintptr_t>(base) + byte_size) & ~(page_size - 1);
+  if (end <= begin) {
+    return nullptr;  // success
+  }
+
+  const size_t bits = 8 * sizeof(unsigned long);
+  std::vector<unsigned long> mask(node / bits + 1, 0);
+  mask[node / bits] |= 1UL << (node % bits);
+  if (syscall(
+          SYS_mbind, begin, end - begin, kMpolPreferred, mask.data(),
+          mask.size() * bits + 1, 0) != 0) {
+    return TRITONSERVER_ErrorNew(
+        TRITONSERVER_ERROR_INTERNAL,
+        (std::string("failed to bind memory: ") + strerror(errno)).c_str());
+  }
+  return nullptr;  // success
+}
+
+ScopedThreadMemoryNode::ScopedThreadMemoryNode(const int node)
+    : saved_mode_(0), saved_mask_(kMaxNodes / (8 * sizeof(unsigned long))),
+      restore_(false)
+{
+  if (node < 0) {
+    return;
+  }
+
+  // Save the current policy to restore it as it was, the thread may
+  // already prefer a node of its own.
+  if (syscall(
+          SYS_get_mempolicy, &saved_mode_, saved_mask_.data(), kMaxNodes,
+          nullptr, 0) != 0) {
+    LOG_MESSAGE(
+        TRITONSERVER_LOG_WARN,
+        (std::string("failed to get memory policy, not preferring NUMA "
+                     "node ") +
+         std::to_string(node) + ": " + strerror(errno))
+            .c_str());
+    return;
+  }
+
+  TRITONSERVER_Error* err = SetThreadMemoryNode(node);
+  if (err != nullptr) {
+    LOG_IF_ERROR(
+        err, ("failed to prefer memory of NUMA node " + std::to_string(node))
+                 .c_str());
+    return;
+  }
+  restore_ = true;
+}
+
+ScopedThreadMemoryNode::~ScopedThreadMemoryNode()
+{
+  if (restore_ &&
+      (syscall(
+           SYS_set_mempolicy, saved_mode_, saved_mask_.data(), kMaxNodes) !=
+       0)) {
+    LOG_MESSAGE(
+        TRITONSERVER_LOG_ERROR,
+        (std::string("failed to restore memory policy: ") + strerror(errno))
+            .c_str());
+  }
+}
+
+TRITONSERVER_Error*
+MemoryMappedFile::Create(
+    const std::string& path, std::unique_ptr<MemoryMappedFile>* file)
+{
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return TRITONSERVER_ErrorNew(
+        TRITONSERVER_ERROR_INTERNAL,
+        (std::string("failed to open '") + path + "': " + strerror(errno))
+            .c_str());
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    const int err = errno;
+    close(fd);
+    return TRITONSERVER_ErrorNew(
+        TRITONSERVER_ERROR_INTERNAL,
+        (std::string("failed to stat '") + path + "': " + strerror(err))
+            .c_str());
+  }
+
+  const size_t size = static_cast<size_t>(st.st_size);
+  void* base = nullptr;
+  if (size > 0) {
+    base = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (base == MAP_FAILED) {
+      const int err = errno;
+      close(fd);
+      return TRITONSERVER_ErrorNew(
+          TRITONSERVER_ERROR_INTERNAL,
+          (std::string("failed to mmap '") + path + "': " + strerror(err))
+              .c_str());
+    }
+
+    // The deserializer walks the archive front to back so ask for
+    // aggressive read-ahead.
+    madvise(base, size, MADV_SEQUENTIAL);
+  }
+
+  // The mapping stays valid after the descriptor is closed.
+  close(fd);
+
+  file->reset(new MemoryMappedFile(static_cast<const char*>(base), size));
+  return nullptr;  // success
+}
+
+MemoryMappedFile::~MemoryMappedFile()
+{
+  if (base_ != nullptr) {
+    munmap(const_cast<char*>(base_), size_);
+  }
+}
+
+std::unique_ptr<caffe2::serialize::ReadAdapterInterface>
+MemoryMappedFile::NewReadAdapter() const
+{
+  return std::unique_ptr<caffe2::serialize::ReadAdapterInterface>(
+      new ReadAdapter(this));
+}
+
+size_t
+MemoryMappedFile::ReadAdapter::read(
+    uint64_t pos, void* buf, size_t n, const char* what) const
+{
+  const size_t size = file_->Size();
+  if (pos >= size) {
+    return 0;
+  }
+
+  n = std::min(n, static_cast<size_t>(size - pos));
+  std::memcpy(buf, file_->Data() + pos, n);
+  return n;
+}
+
+uint64_t
+HashBytes(const void* data, const size_t size)
+{
+  // MurmurHash64A, which consumes 8 bytes per step and so hashes large
+  // model files at close to memory bandwidth.
+  const uint64_t m = 0xc6a4a7935bd1e995ULL;
+  const int r = 47;
+
+  uint64_t h = 0x9747b28c5bd1e995ULL ^ (static_cast<uint64_t>(size) * m);
+
+  const unsigned char* bytes = static_cast<const unsigned char*>(data);
+  const size_t block_count = size / sizeof(uint64_t);
+  for (size_t i = 0; i < block_count; ++i) {
+    uint64_t k;
+    std::memcpy(&k, bytes + (i * sizeof(uint64_t)), sizeof(uint64_t));
+
+    k *= m;
+    k ^= k >> r;
+    k *= m;
+
+    h ^= k;
+    h *= m;
+  }
+
+  const size_t tail_size = size % sizeof(uint64_t);
+  if (tail_size != 0) {
+    uint64_t k = 0;
+    std::memcpy(&k, bytes + (block_count * sizeof(uint64_t)), tail_size);
+    h ^= k;
+    h *= m;
+  }
+
+  h ^= h >> r;
+  h *= m;
+  h ^= h >> r;
+
+  return h;
+}
+
+void
+GetProcessMemoryUsage(uint64_t* rss_bytes, uint64_t* peak_rss_bytes)
+{
+  *rss_bytes = 0;
+  *peak_rss_bytes = 0;
+
+  // Values in /proc/self/status are reported in kB.
+  std::ifstream status("/proc/self/status");
+  std::string line;
+  while (std::getline(status, line)) {
+    if (line.rfind("VmRSS:", 0) == 0) {
+      *rss_bytes = std::strtoull(line.c_str() + 6, nullptr, 10) * 1024;
+    } else if (line.rfind("VmHWM:", 0) == 0) {
+      *peak_rss_bytes = std::strtoull(line.c_str() + 6, nullptr, 10) * 1024;
+    }
+  }
+}
+
 }}}  // namespace triton::backend::pytorch
@@ -26,12 +26,19 @@
 
 #pragma once
 
+#include <sched.h>
+#include <memory>
+#include <string>
+#include <vector>
+#include "triton/backend/backend_common.h"
+#include "triton/common/triton_json.h"
 #include "triton/core/tritonserver.h"
 
 // Suppress warnings in torch headers
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wsign-compare"
 #pragma warning(push, 0)
+#include <caffe2/serialize/read_adapter_interface.h>
 #include <torch/script.h>  // One-stop header for TorchScript
 #pragma warning(pop)
 #pragma GCC diagnostic pop
@@ -54,4 +61,189 @@ std::pair<bool, torch::ScalarType> ConvertDataTypeToTorchType(
 std::pair<bool, torch::ScalarType> ModelConfigDataTypeToTorchType(
     const std::string& data_type_str);
 
+// Parse the value of parameter 'mkey' from the model configuration
+// 'parameters' object 'params'. Return a TRITONSERVER_ERROR_NOT_FOUND
+// error if the parameter is not present.
+TRITONSERVER_Error* ParseParameter(
+    triton::common::TritonJson::Value& params, const std::string& mkey,
+    bool* value);
+TRITONSERVER_Error* ParseParameter(
+    triton::common::TritonJson::Value& params, const std::string& mkey,
+    int* value);
+TRITONSERVER_Error* ParseParameter(
+    triton::common::TritonJson::Value& params, const std::string& mkey,
+    std::string* value);
+// Parse a comma-separated list of integers, for example "1,8,32".
+TRITONSERVER_Error* ParseParameter(
+    triton::common::TritonJson::Value& params, const std::string& mkey,
+    std::vector<int64_t>* value);
+
+// Split 'str' at each 'delim' and return the pieces with leading and
+// trailing whitespace removed. Empty pieces are dropped.
+std::vector<std::string> SplitString(const std::string& str, const char delim);
+
+// Return the index encoded in a tensor name that follows the
+// <name>__<index> naming convention, or -1 if the name doesn't follow
+// the convention.
+int NamingConventionIndex(const std::string& tensor_name);
+
+// Return the smallest of the ascending 'buckets' that is at least
+// 'size', or 'size' itself if it exceeds every bucket.
+int64_t RoundUpToBucket(
+    const std::vector<int64_t>& buckets, const int64_t size);
+
+// Parse a list of CPUs and CPU ranges, for example "0-3,8,10-11", into
+// the sorted CPU numbers 'cpus'.
+TRITONSERVER_Error* ParseCpuList(
+    const std::string& str, std::vector<int>* cpus);
+
+// Return in 'cpus' the CPUs this process may run on.
+TRITONSERVER_Error* GetProcessCpus(std::vector<int>* cpus);
+
+// Restrict the calling thread to 'cpus'. Threads it creates afterwards
+// inherit the restriction.
+TRITONSERVER_Error* SetThreadAffinity(const std::vector<int>& cpus);
+
+// Restrict the calling thread to 'cpus' for the lifetime of the object,
+// then restore its previous affinity. Does nothing if 'cpus' is empty.
+class ScopedThreadAffinity {
+ public:
+  explicit ScopedThreadAffinity(const std::vector<int>& cpus);
+  ~ScopedThreadAffinity();
+
+  ScopedThreadAffinity(const ScopedThreadAffinity&) = delete;
+  ScopedThreadAffinity& operator=(const ScopedThreadAffinity&) = delete;
+
+ private:
+  cpu_set_t saved_set_;
+  bool restore_;
+};
+
+// Run libtorch intra-op parallel work started by the calling thread
+// with 'thread_count' threads for the lifetime of the object, then
+// restore the previous count. Does nothing if 'thread_count' is 0.
+class ScopedIntraOpThreads {
+ public:
+  explicit ScopedIntraOpThreads(const int thread_count);
+  ~ScopedIntraOpThreads();
+
+  ScopedIntraOpThreads(const ScopedIntraOpThreads&) = delete;
+  ScopedIntraOpThreads& operator=(const ScopedIntraOpThreads&) = delete;
+
+ private:
+  // The count to restore, 0 if the count wasn't changed.
+  int previous_thread_count_;
+};
+
+// A NUMA node of the host and its CPUs.
+struct NumaNode {
+  int id;
+  std::vector<int> cpus;
+};
+
+// Return the NUMA nodes of the host that have CPUs, ordered by id.
+// Empty if the topology is not available.
+std::vector<NumaNode> GetNumaNodes();
+
+// Make memory that the calling thread allocates from now on come from
+// NUMA node 'node' when it has free memory, or restore the default
+// policy if 'node' is negative.
+TRITONSERVER_Error* SetThreadMemoryNode(const int node);
+
+// Prefer the memory of NUMA node 'node' for the pages of the
+// 'byte_size' bytes at 'base' that are not yet touched, whichever
+// thread touches them. Pages only partially in the range are left as
+// they are.
+TRITONSERVER_Error* BindMemoryToNode(
+    void* base, const size_t byte_size, const int node);
+
+// Prefer the memory of NUMA node 'node' for allocations of the calling
+// thread for the lifetime of the object, then restore the policy the
+// thread had before. Does nothing if 'node' is negative.
+class ScopedThreadMemoryNode {
+ public:
+  explicit ScopedThreadMemoryNode(const int node);
+  ~ScopedThreadMemoryNode();
+
+  ScopedThreadMemoryNode(const ScopedThreadMemoryNode&) = delete;
+  ScopedThreadMemoryNode& operator=(const ScopedThreadMemoryNode&) = delete;
+
+ private:
+  // Number of nodes the saved policy mask holds, the largest number of
+  // nodes the kernel supports.
+  static const unsigned long kMaxNodes = 1024;
+
+  int saved_mode_;
+  std::vector<unsigned long> saved_mask_;
+  bool restore_;
+};
+
+// Same as ParseParameter except that a missing parameter is not an
+// error, in which case 'value' is left unchanged.
+template <typename T>
+TRITONSERVER_Error*
+ParseOptionalParameter(
+    triton::common::TritonJson::Value& params, const std::string& mkey,
+    T* value)
+{
+  TRITONSERVER_Error* err = ParseParameter(params, mkey, value);
+  if ((err != nullptr) &&
+      (TRITONSERVER_ErrorCode(err) == TRITONSERVER_ERROR_NOT_FOUND)) {
+    TRITONSERVER_ErrorDelete(err);
+    err = nullptr;
+  }
+  return err;
+}
+
+//
+// MemoryMappedFile
+//
+// Read-only memory mapping of a file. The mapping can be handed to the
+// TorchScript deserializer through ReadAdapter() so that the model
+// artifact is paged in directly from the page cache instead of first
+// being copied into a heap buffer.
+//
+class MemoryMappedFile {
+ public:
+  class ReadAdapter : public caffe2::serialize::ReadAdapterInterface {
+   public:
+    explicit ReadAdapter(const MemoryMappedFile* file) : file_(file) {}
+    size_t size() const override { return file_->Size(); }
+    size_t read(
+        uint64_t pos, void* buf, size_t n,
+        const char* what = "") const override;
+
+   private:
+    const MemoryMappedFile* file_;
+  };
+
+  static TRITONSERVER_Error* Create(
+      const std::string& path, std::unique_ptr<MemoryMappedFile>* file);
+  ~MemoryMappedFile();
+
+  const char* Data() const { return base_; }
+  size_t Size() const { return size_; }
+
+  // Return a read adapter that references this mapping. The mapping
+  // must outlive the returned adapter.
+  std::unique_ptr<caffe2::serialize::ReadAdapterInterface> NewReadAdapter()
+      const;
+
+ private:
+  MemoryMappedFile(const char* base, size_t size) : base_(base), size_(size)
+  {
+  }
+
+  const char* base_;
+  const size_t size_;
+};
+
+// Return a 64-bit hash of the 'size' bytes at 'data'. The hash is
+// stable across processes and so can be used to name files.
+uint64_t HashBytes(const void* data, const size_t size);
+
+// Return the current and peak resident set size of this process, in
+// bytes. Values are 0 if they cannot be determined.
+void GetProcessMemoryUsage(uint64_t* rss_bytes, uint64_t* peak_rss_bytes);
+
 }}}  // namespace triton::backend::pytorch